@@ -0,0 +1,80 @@
+#ifndef HOGEXE_BOUNDEDQUEUE_H
+#define HOGEXE_BOUNDEDQUEUE_H
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+/**
+ * @brief Blocking FIFO queue with a fixed capacity connecting two pipeline stages
+ *
+ * A full queue blocks the producer, so a slow stage holds back the stages before it
+ * instead of letting frames pile up in memory.
+ *
+ * @tparam T Item type
+ */
+template <typename T>
+class BoundedQueue {
+public:
+    /**
+     * @brief Construct a new BoundedQueue object
+     *
+     * @param capacity Maximal number of queued items
+     */
+    explicit BoundedQueue(size_t capacity) : capacity_(capacity) {}
+
+    /**
+     * @brief Add an item, waiting while the queue is full
+     *
+     * @param item Item to add
+     * @return False if the queue was closed, the item is dropped
+     */
+    bool push(T item) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        notFull_.wait(lock, [this] { return closed_ || items_.size() < capacity_; });
+        if (closed_) {
+            return false;
+        }
+        items_.push_back(std::move(item));
+        notEmpty_.notify_one();
+        return true;
+    }
+
+    /**
+     * @brief Take the oldest item, waiting while the queue is empty
+     *
+     * @param item Output item
+     * @return False once the queue is closed and drained
+     */
+    bool pop(T& item) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        notEmpty_.wait(lock, [this] { return closed_ || !items_.empty(); });
+        if (items_.empty()) {
+            return false;
+        }
+        item = std::move(items_.front());
+        items_.pop_front();
+        notFull_.notify_one();
+        return true;
+    }
+
+    /**
+     * @brief Stop accepting items, consumers still get the queued ones
+     */
+    void close() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        closed_ = true;
+        notEmpty_.notify_all();
+        notFull_.notify_all();
+    }
+
+private:
+    std::mutex mutex_; //!< Guards the queue
+    std::condition_variable notFull_; //!< Wakes the producers
+    std::condition_variable notEmpty_; //!< Wakes the consumers
+    std::deque<T> items_; //!< Queued items
+    size_t capacity_; //!< Maximal number of queued items
+    bool closed_ = false; //!< Set when no more items are accepted
+};
+
+#endif //HOGEXE_BOUNDEDQUEUE_H
@@ -0,0 +1,90 @@
+#ifndef HOGEXE_LATENCYREPORT_H
+#define HOGEXE_LATENCYREPORT_H
+
+#include <hogdescriptor/instrumentation.hpp>
+#include <algorithm>
+#include <array>
+#include <iomanip>
+#include <mutex>
+#include <ostream>
+#include <vector>
+
+/**
+ * @brief Collects the stats of many descriptor calls and prints their latency percentiles
+ *
+ * Descriptors of several threads may report into the same object.
+ * Stays empty unless the library is built with HOG_ENABLE_INSTRUMENTATION=1.
+ */
+class LatencyReport {
+public:
+    /**
+     * @brief Callback for HOGDescriptor::setStatsCallback adding every call to the report
+     */
+    HOGStatsCallback callback() {
+        return [this](const HOGStats& stats) { add(stats); };
+    }
+
+    /**
+     * @brief Add the stats of one call
+     *
+     * @param stats Stats of the call
+     */
+    void add(const HOGStats& stats) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (int stage = 0; stage < HOGStats::STAGE_COUNT; stage++) {
+            stageMs_[stage].push_back(stats.stageMs[stage]);
+        }
+        totalMs_.push_back(stats.totalMs);
+        bytes_ += stats.bytesRead + stats.bytesWritten;
+        allocations_ += stats.allocations;
+        cells_ += stats.cells;
+        blocks_ += stats.blocks;
+    }
+
+    /**
+     * @brief Print p50/p95/p99 of every stage and of the whole call, then the mean counters per call
+     *
+     * @param out Output stream
+     */
+    void print(std::ostream& out) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (totalMs_.empty()) {
+            return;
+        }
+        out << "Latency over " << totalMs_.size() << " calls (ms):" << std::endl;
+        out << std::left << std::setw(16) << "stage" << std::right
+            << std::setw(10) << "p50" << std::setw(10) << "p95" << std::setw(10) << "p99" << std::endl;
+        for (int stage = 0; stage < HOGStats::STAGE_COUNT; stage++) {
+            printRow(out, HOGStats::stageName(static_cast<HOGStats::Stage>(stage)), stageMs_[stage]);
+        }
+        printRow(out, "total", totalMs_);
+
+        double calls = static_cast<double>(totalMs_.size());
+        out << "Per call: " << bytes_ / calls / (1 << 20) << " MiB touched, " << allocations_ / calls << " allocations, "
+            << cells_ / calls << " cells, " << blocks_ / calls << " blocks" << std::endl;
+    }
+
+private:
+    // Nearest-rank percentile of sorted samples
+    static double percentile(const std::vector<double>& sorted, double p) {
+        size_t rank = static_cast<size_t>(p / 100 * sorted.size() + 0.999999);
+        return sorted[std::clamp<size_t>(rank, 1, sorted.size()) - 1];
+    }
+
+    static void printRow(std::ostream& out, const char* name, std::vector<double>& samples) {
+        std::sort(samples.begin(), samples.end());
+        out << std::left << std::setw(16) << name << std::right << std::fixed << std::setprecision(3)
+            << std::setw(10) << percentile(samples, 50) << std::setw(10) << percentile(samples, 95)
+            << std::setw(10) << percentile(samples, 99) << std::defaultfloat << std::endl;
+    }
+
+    std::mutex mutex_;
+    std::array<std::vector<double>, HOGStats::STAGE_COUNT> stageMs_; //!< Samples of each stage
+    std::vector<double> totalMs_; //!< Samples of the whole call
+    uint64_t bytes_ = 0; //!< Bytes read and written by all calls
+    uint64_t allocations_ = 0; //!< Workspace allocations of all calls
+    uint64_t cells_ = 0; //!< Cells binned by all calls
+    uint64_t blocks_ = 0; //!< Blocks normalized by all calls
+};
+
+#endif //HOGEXE_LATENCYREPORT_H
@@ -1,8 +1,23 @@
 #include <hogdescriptor/hogdescriptor.hpp>
+#include <hogdescriptor/featurestore.hpp>
+#include <hogdescriptor/threadpool.hpp>
 #include <texvisualization/texvisualization.hpp>
 #include "opencv2/imgproc/imgproc.hpp"
 #include "opencv2/highgui/highgui.hpp"
+#include "opencv2/videoio/videoio.hpp"
+#include "opencv2/imgcodecs/imgcodecs.hpp"
+#include "boundedqueue.hpp"
+#include "latencyreport.hpp"
 #include <iostream>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <semaphore>
+#include <sstream>
+#include <thread>
 
 
 /**
@@ -66,6 +81,376 @@ void saveSettingsToFile(const HOGSettings& settings) {
     }
 }
 
+/**
+ * @brief Frame travelling through the video pipeline
+ */
+struct VideoFrame {
+    int64_t index; //!< Frame number in the stream
+    cv::Mat data; //!< Decoded frame, then its HOG feature vector as a 1 x n CV_32F row
+};
+
+/**
+ * @brief Method to extract the HOG features of every frame of a video or image sequence
+ * 
+ * Decoding, HOG computation and writing run as overlapped stages connected by bounded queues,
+ * the HOG stage on several threads. Features are written in frame order to a feature store,
+ * labelled with the frame number. The decoder stays at most 4 frames per worker ahead of the
+ * writer, so memory is bounded even when one frame takes long.
+ * 
+ * @param source Video file or image sequence pattern (e.g. frame_%04d.png)
+ * @param outputPath Feature store file, replaced if it exists
+ * @param settings Descriptor settings
+ * @param valueType Type of the values in the store
+ * @return Exit code of the program
+ */
+int processVideo(const std::string& source, const std::string& outputPath, const HOGSettings& settings, HOGValueType valueType) {
+    cv::VideoCapture capture(source);
+    if (!capture.isOpened()) {
+        std::cerr << "Unable to open video: " << source << std::endl;
+        return 1;
+    }
+    // Throws on invalid settings before any thread is started
+    HOGDescriptor checkhogparams(settings.blockSize, settings.cellSize, settings.stride, settings.binNumber, settings.gradType);
+    std::filesystem::remove(outputPath);
+
+    // Decoding and writing take one thread each, the rest computes
+    const unsigned hardwareThreads = std::thread::hardware_concurrency();
+    const unsigned workers = hardwareThreads > 3 ? hardwareThreads - 2 : 1;
+    BoundedQueue<VideoFrame> frames(2 * workers);
+    BoundedQueue<VideoFrame> results(2 * workers);
+    // Frames between the decoder and the writer: a stalled frame stops the decoder instead of
+    // growing the reorder buffer of the writer
+    std::counting_semaphore<> inFlight(4 * workers);
+
+    // The first error stops every stage
+    std::atomic<bool> failed{false};
+    std::mutex errorMutex;
+    std::string error;
+    auto fail = [&](const std::string& message) {
+        {
+            std::lock_guard<std::mutex> lock(errorMutex);
+            if (!failed) {
+                error = message;
+            }
+            failed = true;
+        }
+        frames.close();
+        results.close();
+    };
+
+    std::thread decoder([&] {
+        cv::Mat frame;
+        for (int64_t index = 0; ; index++) {
+            while (!failed && !inFlight.try_acquire_for(std::chrono::milliseconds(100))) {
+            }
+            if (failed || !capture.read(frame) || frame.empty()) {
+                break;
+            }
+            // Clone: the capture may reuse its frame buffer
+            if (!frames.push({index, frame.clone()})) {
+                break;
+            }
+        }
+        frames.close();
+    });
+
+    std::atomic<unsigned> activeWorkers{workers};
+    std::vector<std::thread> computeThreads;
+    LatencyReport latencies;
+    for (unsigned i = 0; i < workers; i++) {
+        computeThreads.emplace_back([&] {
+            // One descriptor per thread, its buffers are reused for every frame
+            HOGDescriptor hog(settings.blockSize, settings.cellSize, settings.stride, settings.binNumber, settings.gradType);
+            hog.setStatsCallback(latencies.callback());
+            cv::Mat gray;
+            VideoFrame frame;
+            while (frames.pop(frame)) {
+                try {
+                    if (frame.data.channels() > 1) {
+                        cv::cvtColor(frame.data, gray, cv::COLOR_BGR2GRAY);
+                    } else {
+                        gray = frame.data;
+                    }
+                    hog.computeHOG(gray);
+                    std::span<const float> features = hog.getHOGFeatureView();
+                    frame.data = cv::Mat(1, static_cast<int>(features.size()), CV_32F, const_cast<float*>(features.data())).clone();
+                } catch (const std::exception& e) {
+                    fail("Frame " + std::to_string(frame.index) + ": " + e.what());
+                    break;
+                }
+                if (!results.push(std::move(frame))) {
+                    break;
+                }
+            }
+            if (--activeWorkers == 0) {
+                results.close();
+            }
+        });
+    }
+
+    // Writer stage: frames finish out of order, keep them until their turn
+    std::unique_ptr<FeatureStoreWriter> store;
+    std::map<int64_t, cv::Mat> pending;
+    int64_t nextIndex = 0;
+    auto start = std::chrono::steady_clock::now();
+    auto lastReport = start;
+    VideoFrame result;
+    while (!failed && results.pop(result)) {
+        try {
+            pending.emplace(result.index, std::move(result.data));
+            for (auto next = pending.find(nextIndex); next != pending.end(); next = pending.find(nextIndex)) {
+                if (!store) {
+                    store = std::make_unique<FeatureStoreWriter>(outputPath, checkhogparams, next->second.cols, valueType);
+                }
+                store->append(next->second, std::span<const int64_t>(&nextIndex, 1));
+                pending.erase(next);
+                nextIndex++;
+                inFlight.release();
+            }
+        } catch (const std::exception& e) {
+            fail(e.what());
+        }
+
+        auto now = std::chrono::steady_clock::now();
+        if (now - lastReport >= std::chrono::seconds(1)) {
+            double seconds = std::chrono::duration<double>(now - start).count();
+            std::cout << "\rFrames: " << nextIndex << ", fps: " << nextIndex / seconds << std::flush;
+            lastReport = now;
+        }
+    }
+
+    decoder.join();
+    for (std::thread& thread : computeThreads) {
+        thread.join();
+    }
+    if (failed) {
+        std::cerr << std::endl << "Error: " << error << std::endl;
+        return 1;
+    }
+    if (store) {
+        store->close();
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "\rFrames: " << nextIndex << ", time: " << seconds << " s, sustained fps: "
+              << (seconds > 0 ? nextIndex / seconds : 0.0) << std::endl;
+    latencies.print(std::cout);
+    std::cout << "Features saved to " << outputPath << std::endl;
+    return 0;
+}
+
+/**
+ * @brief Image of a batch with its label
+ */
+struct BatchItem {
+    std::string path; //!< Path to the image
+    int64_t label; //!< Label stored with the features
+};
+
+/**
+ * @brief Method to list the images of a directory or a manifest
+ * 
+ * In a directory every image is labelled with the index of its first-level subfolder
+ * (subfolders in alphabetical order), images directly in the directory get -1.
+ * A manifest has one "<path> <label>" line per image, paths relative to the manifest,
+ * a missing label is 0 and lines starting with # are skipped.
+ * 
+ * @param source Directory or manifest file
+ * @return Images in a stable order
+ */
+std::vector<BatchItem> collectBatchItems(const std::string& source) {
+    namespace fs = std::filesystem;
+    std::vector<BatchItem> items;
+
+    if (fs::is_directory(source)) {
+        const std::vector<std::string> extensions = {".jpg", ".jpeg", ".png", ".bmp", ".tif", ".tiff", ".pgm", ".ppm", ".webp"};
+        std::vector<fs::path> classes;
+        for (const fs::directory_entry& entry : fs::directory_iterator(source)) {
+            if (entry.is_directory()) {
+                classes.push_back(entry.path());
+            }
+        }
+        std::sort(classes.begin(), classes.end());
+        for (size_t i = 0; i < classes.size(); i++) {
+            std::cout << "Label " << i << ": " << classes[i].filename().string() << std::endl;
+        }
+
+        for (const fs::directory_entry& entry : fs::recursive_directory_iterator(source)) {
+            std::string extension = entry.path().extension().string();
+            std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return std::tolower(c); });
+            if (!entry.is_regular_file() || std::find(extensions.begin(), extensions.end(), extension) == extensions.end()) {
+                continue;
+            }
+            fs::path first = *fs::relative(entry.path(), source).begin();
+            auto found = std::find(classes.begin(), classes.end(), fs::path(source) / first);
+            int64_t label = found == classes.end() ? -1 : found - classes.begin();
+            items.push_back({entry.path().string(), label});
+        }
+        std::sort(items.begin(), items.end(), [](const BatchItem& a, const BatchItem& b) { return a.path < b.path; });
+    } else {
+        std::ifstream manifest(source);
+        if (!manifest.is_open()) {
+            throw std::runtime_error("Unable to open manifest: " + source);
+        }
+        fs::path base = fs::path(source).parent_path();
+        std::string line;
+        while (std::getline(manifest, line)) {
+            if (!line.empty() && line.back() == '\r') {
+                line.pop_back();
+            }
+            if (line.empty() || line[0] == '#') {
+                continue;
+            }
+            // The label is the last field if it is a number, so paths may contain spaces
+            BatchItem item{line, 0};
+            size_t split = line.find_last_of(" \t");
+            if (split != std::string::npos) {
+                std::istringstream field(line.substr(split + 1));
+                int64_t label;
+                if (field >> label && field.eof()) {
+                    item.path = line.substr(0, line.find_last_not_of(" \t", split) + 1);
+                    item.label = label;
+                }
+            }
+            fs::path path(item.path);
+            item.path = (path.is_absolute() ? path : base / path).string();
+            items.push_back(item);
+        }
+    }
+    return items;
+}
+
+/**
+ * @brief Method to extract the HOG features of a whole dataset into one feature store
+ * 
+ * Images are decoded straight to grayscale and computed on the thread pool, chunk by chunk,
+ * and every chunk is appended to the store in the order of the list. Images that cannot be
+ * read or whose size gives another vector length than the first image are skipped.
+ * No window is opened.
+ * 
+ * @param source Directory or manifest file
+ * @param outputPath Feature store file, replaced if it exists
+ * @param settings Descriptor settings
+ * @param valueType Type of the values in the store
+ * @return Exit code of the program
+ */
+int processBatch(const std::string& source, const std::string& outputPath, const HOGSettings& settings, HOGValueType valueType) {
+    HOGDescriptor hog(settings.blockSize, settings.cellSize, settings.stride, settings.binNumber, settings.gradType);
+    std::vector<BatchItem> items = collectBatchItems(source);
+    if (items.empty()) {
+        std::cerr << "No images found in " << source << std::endl;
+        return 1;
+    }
+
+    // The first readable image fixes the vector length of the store
+    size_t descriptorSize = 0;
+    for (const BatchItem& item : items) {
+        cv::Mat image = cv::imread(item.path, cv::IMREAD_GRAYSCALE);
+        if (!image.empty() && (descriptorSize = hog.getDescriptorSize(image.size())) > 0) {
+            break;
+        }
+    }
+    if (descriptorSize == 0) {
+        std::cerr << "None of the images can be read or holds a block" << std::endl;
+        return 1;
+    }
+    std::filesystem::remove(outputPath);
+    FeatureStoreWriter store(outputPath, hog, descriptorSize, valueType);
+
+    ThreadPool& pool = ThreadPool::global();
+    const int chunkSize = static_cast<int>(pool.size()) * 16;
+    cv::Mat features(chunkSize, static_cast<int>(descriptorSize), CV_32F);
+    std::vector<std::string> errors(chunkSize);
+    size_t written = 0;
+    size_t skipped = 0;
+    LatencyReport latencies;
+    auto start = std::chrono::steady_clock::now();
+
+    // Descriptors are kept warm across chunks: a range takes an idle one and gives it back.
+    // A thread waiting inside computeHOG may run another range, so descriptors are not tied to threads.
+    std::mutex idleMutex;
+    std::vector<std::unique_ptr<HOGDescriptor>> idle;
+    auto acquire = [&]() {
+        {
+            std::lock_guard<std::mutex> lock(idleMutex);
+            if (!idle.empty()) {
+                std::unique_ptr<HOGDescriptor> taskHog = std::move(idle.back());
+                idle.pop_back();
+                return taskHog;
+            }
+        }
+        auto taskHog = std::make_unique<HOGDescriptor>(settings.blockSize, settings.cellSize, settings.stride, settings.binNumber, settings.gradType);
+        taskHog->setStatsCallback(latencies.callback());
+        return taskHog;
+    };
+
+    for (size_t chunkBegin = 0; chunkBegin < items.size(); chunkBegin += chunkSize) {
+        int count = static_cast<int>(std::min<size_t>(chunkSize, items.size() - chunkBegin));
+        pool.parallelFor(0, count, [&](int begin, int end) {
+            std::unique_ptr<HOGDescriptor> taskHog = acquire();
+            for (int i = begin; i < end; i++) {
+                const BatchItem& item = items[chunkBegin + i];
+                errors[i].clear();
+                cv::Mat image = cv::imread(item.path, cv::IMREAD_GRAYSCALE);
+                if (image.empty()) {
+                    errors[i] = "cannot be read";
+                    continue;
+                }
+                if (taskHog->getDescriptorSize(image.size()) != descriptorSize) {
+                    errors[i] = "gives another vector length";
+                    continue;
+                }
+                taskHog->computeHOG(image);
+                std::span<const float> vector = taskHog->getHOGFeatureView();
+                std::copy(vector.begin(), vector.end(), features.ptr<float>(i));
+            }
+            std::lock_guard<std::mutex> lock(idleMutex);
+            idle.push_back(std::move(taskHog));
+        });
+
+        for (int i = 0; i < count; i++) {
+            const BatchItem& item = items[chunkBegin + i];
+            if (!errors[i].empty()) {
+                std::cerr << std::endl << "Skipped " << item.path << ": " << errors[i] << std::endl;
+                skipped++;
+                continue;
+            }
+            store.append(std::span<const float>(features.ptr<float>(i), descriptorSize), item.label);
+            written++;
+        }
+
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::cout << "\rImages: " << chunkBegin + count << "/" << items.size() << ", skipped: " << skipped
+                  << ", images/s: " << (seconds > 0 ? (chunkBegin + count) / seconds : 0.0) << std::flush;
+    }
+    store.close();
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << std::endl << written << " vectors of " << descriptorSize << " values saved to " << outputPath
+              << " in " << seconds << " s" << std::endl;
+    latencies.print(std::cout);
+    return 0;
+}
+
+/**
+ * @brief Method to parse the value type argument of -video and -batch
+ * 
+ * @param name f32, f16 or u8
+ * @param valueType Output value type
+ * @return True if the name is known
+ */
+bool parseValueType(const std::string& name, HOGValueType& valueType) {
+    if (name == "f32") {
+        valueType = HOGValueType::FLOAT32;
+    } else if (name == "f16") {
+        valueType = HOGValueType::FLOAT16;
+    } else if (name == "u8") {
+        valueType = HOGValueType::UINT8;
+    } else {
+        return false;
+    }
+    return true;
+}
 
 int main(int argc, char** argv){
     std::string currentdir = INSTALL_PATH;
@@ -75,6 +460,12 @@ int main(int argc, char** argv){
         std::cout << "./hogexe -test [1-3]: Demo of the HOG algorithm work (1, 2 or 3)" << std::endl;
         std::cout << "./hogexe -settings: Show current settings" << std::endl;
         std::cout << "./hogexe -p <path to image> : Process your image" << std::endl;
+        std::cout << "./hogexe -video <path to video or image sequence> [output store] [f32|f16|u8]: Extract the features of every frame without windows" << std::endl;
+        std::cout << "./hogexe -batch <directory or manifest> [output store] [f32|f16|u8]: Extract the features of a dataset without windows" << std::endl;
+        std::cout << "f16 and u8 store half precision or 8-bit values, 2 and about 4 times smaller than f32 (default)" << std::endl;
+        if (HOGStats::enabled) {
+            std::cout << "-video and -batch print the p50/p95/p99 latency of every stage at the end" << std::endl;
+        }
     }
     else if ((std::string(argv[1]) == "-settings" || std::string(argv[1]) == "-s") && argc == 2) {
         std::cout << "------------------------Текущие настройки-------------------------" << std::endl;
@@ -240,11 +631,52 @@ int main(int argc, char** argv){
         }
         cv::waitKey(0);
     }
+    else if (std::string(argv[1]) == "-video" || std::string(argv[1]) == "-v") {
+        HOGValueType valueType = HOGValueType::FLOAT32;
+        if (argc < 3 || argc > 5 || (argc == 5 && !parseValueType(argv[4], valueType))) {
+            std::cerr << "Incorrect arguments. Enter ./hogexe -video /path/to/video [output store] [f32|f16|u8]" << std::endl;
+            return 1;
+        }
+        std::string videoPath = argv[2];
+        std::string outputPath;
+        if (argc >= 4) {
+            outputPath = argv[3];
+        } else {
+            // <output folder>/<video name>.hogstore
+            outputPath = (std::filesystem::path(settings.folderPath) / std::filesystem::path(videoPath).stem()).string() + ".hogstore";
+        }
+        return processVideo(videoPath, outputPath, settings, valueType);
+    }
+    else if (std::string(argv[1]) == "-batch" || std::string(argv[1]) == "-b") {
+        HOGValueType valueType = HOGValueType::FLOAT32;
+        if (argc < 3 || argc > 5 || (argc == 5 && !parseValueType(argv[4], valueType))) {
+            std::cerr << "Incorrect arguments. Enter ./hogexe -batch /path/to/dataset [output store] [f32|f16|u8]" << std::endl;
+            return 1;
+        }
+        std::string datasetPath = argv[2];
+        std::string outputPath;
+        if (argc >= 4) {
+            outputPath = argv[3];
+        } else {
+            // <output folder>/<dataset name>.hogstore
+            std::filesystem::path dataset = std::filesystem::path(datasetPath);
+            std::string name = dataset.has_filename() ? dataset.stem().string() : dataset.parent_path().filename().string();
+            outputPath = (std::filesystem::path(settings.folderPath) / name).string() + ".hogstore";
+        }
+        try {
+            return processBatch(datasetPath, outputPath, settings, valueType);
+        } catch (const std::exception& e) {
+            std::cerr << std::endl << "Error: " << e.what() << std::endl;
+            return 1;
+        }
+    }
     else {
         std::cout << "Program usage example: " << std::endl;
         std::cout << "./hogexe -test 2: Demo of HOG algorithm on test2.jpg" << std::endl;
         std::cout << "./hogexe -settings: Show settings" << std::endl;
         std::cout << "./hogexe -p /path/to/image: Process user image" << std::endl;
+        std::cout << "./hogexe -video /path/to/video.mp4: Save the features of every frame" << std::endl;
+        std::cout << "./hogexe -batch /path/to/dataset: Save the features of every image of a folder or manifest" << std::endl;
         std::cout << "./hogexe -help: Show program usage" << std::endl;
     }
     return 0;
@@ -0,0 +1,355 @@
+#include <hogdescriptor/hogdescriptor.hpp>
+#include <hogdescriptor/featurestore.hpp>
+#include <hogdescriptor/npywriter.hpp>
+#include <hogdescriptor/threadpool.hpp>
+#include "gradientkernels.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+/**
+ * @brief Access to the pipeline stages of HOGDescriptor, one call per stage
+ */
+class HOGBenchmark {
+public:
+    /**
+     * @brief Full-image gradient magnitude and orientation (Sobel and cartToPolar), built on demand for visualizeHOG
+     */
+    static void gradientImages(HOGDescriptor& hog, const cv::Mat& image) {
+        hog.computeGradientFeatures(image);
+    }
+
+
+    /**
+     * @brief Whole fused pass of computeHOG, gradients and cell binning into the descriptor histograms
+     */
+    static void fusedBinning(HOGDescriptor& hog, const cv::Mat& image) {
+        hog.computeCellHistograms(image, hog.workspace_.cellHistograms);
+    }
+
+    /**
+     * @brief Normalization of every block with the norm type of the descriptor
+     *
+     * @param blocks Concatenated raw blocks, normalized in place
+     * @param blockLength Number of values in each block
+     */
+    static void blockNormalization(HOGDescriptor& hog, std::vector<float>& blocks, size_t blockLength) {
+        for (size_t offset = 0; offset + blockLength <= blocks.size(); offset += blockLength) {
+            hog.normalizeBlockHistogram(std::span<float>(blocks.data() + offset, blockLength));
+        }
+    }
+
+    /**
+     * @brief Block gathering and normalization of the final vector from the current histograms
+     */
+    static void vectorAssembly(HOGDescriptor& hog) {
+        hog.calculateHOGVector(hog.workspace_.cellHistograms);
+    }
+
+    /**
+     * @brief Compact cell features of the final vector from the current histograms
+     */
+    static void compactAssembly(HOGDescriptor& hog) {
+        hog.calculateCompactVector(hog.workspace_.cellHistograms);
+    }
+};
+
+namespace {
+
+/**
+ * @brief Row loads and gradient kernel of the fused pass over the cell grid of an 8-bit image, without the binning
+ *
+ * Same bands on the thread pool as the fused pass of computeHOG, so fused_binning minus this
+ * stage is the cost of the accumulation into the histograms.
+ */
+void fusedGradients(const cv::Mat& image, int cellSize, int binNumber, int gradType) {
+    const hogkernels::BinningParams params{static_cast<float>(gradType / binNumber), binNumber, gradType == 360};
+    const hogkernels::GradientRowFn gradientRow = hogkernels::gradientRow(params.signedGradient);
+    const int cellsY = image.rows / cellSize;
+    const int n = image.cols / cellSize * cellSize;
+    const int bandRows = image.total() < HOGDescriptor::PARALLEL_MIN_PIXELS ? cellsY :
+        std::max(1, static_cast<int>(HOGDescriptor::PARALLEL_MIN_PIXELS / 4 / (static_cast<size_t>(cellSize) * image.cols)));
+    const int bandCount = (cellsY + bandRows - 1) / bandRows;
+
+    // Mirrored at the borders like the row loader of the library
+    auto load = [&](int y, float* dst) {
+        y = y < 0 ? 1 : (y >= image.rows ? image.rows - 2 : y);
+        const uchar* row = image.ptr<uchar>(y);
+        const float scale = static_cast<float>(1 / 255.0);
+        dst[0] = row[1] * scale;
+        for (int x = 0; x < n; ++x) {
+            dst[x + 1] = row[x] * scale;
+        }
+        dst[n + 1] = row[n < image.cols ? n : image.cols - 2] * scale;
+    };
+    auto bandLoop = [&](int begin, int end) {
+        std::vector<float> rows(3 * static_cast<size_t>(n + 2)), magnitude(n);
+        std::vector<int> bin(n);
+        for (int band = begin; band < end; ++band) {
+            float* above = rows.data();
+            float* row = above + n + 2;
+            float* below = row + n + 2;
+            const int y0 = band * bandRows * cellSize;
+            const int y1 = std::min(cellsY, (band + 1) * bandRows) * cellSize;
+            load(y0 - 1, above);
+            load(y0, row);
+            for (int y = y0; y < y1; ++y) {
+                load(y + 1, below);
+                gradientRow(above, row, below, n, params, magnitude.data(), bin.data());
+                std::swap(above, row);
+                std::swap(row, below);
+            }
+        }
+    };
+    ThreadPool::global().parallelFor(0, bandCount, std::cref(bandLoop));
+}
+
+/**
+ * @brief Parameter set of a benchmark run
+ */
+struct BenchParams {
+    std::string name; //!< Name in the report
+    int blockSize; //!< Block size
+    int cellSize; //!< Cell size
+    int stride; //!< Block stride
+    int binNumber; //!< Number of bins
+    int gradType; //!< Gradient type (180 or 360)
+};
+
+/**
+ * @brief Timings of one stage
+ */
+struct Timing {
+    int iterations = 0; //!< Number of timed runs
+    double minMs = 0; //!< Fastest run
+    double medianMs = 0; //!< Median run
+    double meanMs = 0; //!< Mean run
+};
+
+const std::vector<std::pair<std::string, cv::Size>> IMAGE_SIZES = {
+    {"vga", {640, 480}}, {"hd", {1280, 720}}, {"fullhd", {1920, 1080}}, {"4k", {3840, 2160}}};
+
+const std::vector<BenchParams> PARAMETER_SETS = {
+    {"default", 16, 8, 8, 9, 180},
+    {"cell16", 32, 16, 16, 9, 180},
+    {"signed18", 16, 8, 8, 18, 360},
+    {"block3x3", 24, 8, 8, 9, 180}};
+
+// Deterministic textured image: smooth gradients, edges of a few shapes and pixel noise
+cv::Mat syntheticImage(const cv::Size& size) {
+    cv::Mat image(size, CV_8UC1);
+    uint32_t state = 12345;
+    for (int y = 0; y < size.height; ++y) {
+        uchar* row = image.ptr<uchar>(y);
+        for (int x = 0; x < size.width; ++x) {
+            state = state * 1664525u + 1013904223u;
+            int value = (x * 255 / size.width + y * 127 / size.height) / 2;
+            if (((x / 97) + (y / 61)) % 3 == 0) {
+                value = 255 - value;
+            }
+            row[x] = static_cast<uchar>(std::clamp(value + static_cast<int>(state >> 28) - 8, 0, 255));
+        }
+    }
+    return image;
+}
+
+// Runs setup untimed and body timed until minSeconds have passed, at least three times unless a run is slower
+template <typename Setup, typename Body>
+Timing measure(double minSeconds, Setup setup, Body body) {
+    std::vector<double> runs;
+    double total = 0;
+    while (runs.size() < 1000 && (total < minSeconds || runs.size() < 3)) {
+        setup();
+        auto start = std::chrono::steady_clock::now();
+        body();
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        runs.push_back(ms);
+        total += ms / 1000;
+        if (runs.size() == 1 && ms / 1000 > minSeconds) {
+            break;
+        }
+    }
+    std::sort(runs.begin(), runs.end());
+    Timing timing;
+    timing.iterations = static_cast<int>(runs.size());
+    timing.minMs = runs.front();
+    timing.medianMs = runs[runs.size() / 2];
+    for (double ms : runs) {
+        timing.meanMs += ms / runs.size();
+    }
+    return timing;
+}
+
+std::vector<std::string> splitList(const std::string& list) {
+    std::vector<std::string> items;
+    std::stringstream stream(list);
+    std::string item;
+    while (std::getline(stream, item, ',')) {
+        items.push_back(item);
+    }
+    return items;
+}
+
+void printUsage() {
+    std::cout << "Usage: ./hog_bench [--out file.json|-] [--min-time seconds] [--sizes vga,hd,fullhd,4k] [--params default,cell16,signed18,block3x3]" << std::endl;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    std::string outputPath = "hog_bench.json";
+    double minSeconds = 0.3;
+    std::vector<std::string> sizeNames, paramNames;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--out" && i + 1 < argc) {
+            outputPath = argv[++i];
+        } else if (arg == "--min-time" && i + 1 < argc) {
+            minSeconds = std::stod(argv[++i]);
+        } else if (arg == "--sizes" && i + 1 < argc) {
+            sizeNames = splitList(argv[++i]);
+        } else if (arg == "--params" && i + 1 < argc) {
+            paramNames = splitList(argv[++i]);
+        } else {
+            printUsage();
+            return arg == "--help" || arg == "-h" ? 0 : 1;
+        }
+    }
+
+    fs::path scratch = fs::temp_directory_path() / "hog_bench";
+    fs::create_directories(scratch);
+
+    std::ostringstream results;
+    bool firstResult = true;
+    auto report = [&](const std::string& stage, const std::string& sizeName, const cv::Size& size, const BenchParams& params, const Timing& timing) {
+        double megapixels = static_cast<double>(size.area()) / 1e6;
+        results << (firstResult ? "\n" : ",\n")
+                << "    {\"stage\": \"" << stage << "\", \"size\": \"" << sizeName << "\", \"width\": " << size.width
+                << ", \"height\": " << size.height << ", \"params\": \"" << params.name << "\""
+                << ", \"blockSize\": " << params.blockSize << ", \"cellSize\": " << params.cellSize
+                << ", \"stride\": " << params.stride << ", \"binNumber\": " << params.binNumber << ", \"gradType\": " << params.gradType
+                << ", \"iterations\": " << timing.iterations << ", \"min_ms\": " << timing.minMs
+                << ", \"median_ms\": " << timing.medianMs << ", \"mean_ms\": " << timing.meanMs
+                << ", \"mpix_per_s\": " << megapixels / (timing.medianMs / 1000) << "}";
+        firstResult = false;
+        std::cerr << sizeName << " " << params.name << " " << stage << ": " << timing.medianMs << " ms" << std::endl;
+    };
+
+    for (const auto& [sizeName, size] : IMAGE_SIZES) {
+        if (!sizeNames.empty() && std::find(sizeNames.begin(), sizeNames.end(), sizeName) == sizeNames.end()) {
+            continue;
+        }
+        cv::Mat image = syntheticImage(size);
+
+        for (const BenchParams& params : PARAMETER_SETS) {
+            if (!paramNames.empty() && std::find(paramNames.begin(), paramNames.end(), params.name) == paramNames.end()) {
+                continue;
+            }
+            HOGDescriptor hog(params.blockSize, params.cellSize, params.stride, params.binNumber, params.gradType);
+            auto none = [] {};
+
+            report("compute_hog", sizeName, size, params, measure(minSeconds, none, [&] { hog.computeHOG(image); }));
+            // The fused pass minus its gradients is the cost of the binning, the gradient images are not on the computeHOG path
+            report("gradient_images", sizeName, size, params, measure(minSeconds, none, [&] { HOGBenchmark::gradientImages(hog, image); }));
+            report("fused_gradients", sizeName, size, params, measure(minSeconds, none,
+                [&] { fusedGradients(image, params.cellSize, params.binNumber, params.gradType); }));
+            report("fused_binning", sizeName, size, params, measure(minSeconds, none, [&] { HOGBenchmark::fusedBinning(hog, image); }));
+
+            // Raw blocks of the block grid, restored before every normalization run
+            hog.computeHOG(image);
+            int cellsPerBlock = params.blockSize / params.cellSize;
+            size_t blockLength = static_cast<size_t>(cellsPerBlock) * cellsPerBlock * params.binNumber;
+            std::vector<float> rawBlocks;
+            rawBlocks.reserve(hog.getHOGFeatureView().size());
+            const CellHistograms& cells = hog.getCellHistograms();
+            int strideCells = params.stride / params.cellSize;
+            for (int y = 0; y + cellsPerBlock <= cells.rows(); y += strideCells) {
+                for (int x = 0; x + cellsPerBlock <= cells.cols(); x += strideCells) {
+                    for (std::span<const float> cell : hog.getBlockHistogram(y, x)) {
+                        rawBlocks.insert(rawBlocks.end(), cell.begin(), cell.end());
+                    }
+                }
+            }
+            std::vector<float> blocks;
+            report("block_normalization", sizeName, size, params, measure(minSeconds,
+                [&] { blocks = rawBlocks; },
+                [&] { HOGBenchmark::blockNormalization(hog, blocks, blockLength); }));
+            report("vector_assembly", sizeName, size, params, measure(minSeconds, none, [&] { HOGBenchmark::vectorAssembly(hog); }));
+
+            // Serialization of the vector: the text format, the feature store and .npy
+            std::span<const float> vector = hog.getHOGFeatureView();
+            std::streambuf* console = std::cout.rdbuf();
+            std::ofstream discard;
+            std::cout.rdbuf(discard.rdbuf());
+            Timing text = measure(minSeconds, none, [&] { hog.saveVectorData(scratch.string(), "vector.txt"); });
+            std::cout.rdbuf(console);
+            report("save_vector_data", sizeName, size, params, text);
+            fs::path storePath = scratch / "vector.hogstore";
+            report("feature_store", sizeName, size, params, measure(minSeconds,
+                [&] { fs::remove(storePath); },
+                [&] { FeatureStoreWriter store(storePath.string(), hog, vector.size()); store.append(vector); }));
+            report("npy", sizeName, size, params, measure(minSeconds, none, [&] { npy::save((scratch / "vector.npy").string(), vector); }));
+
+            // Conversions of the vector to the compact value types and back
+            std::vector<uint16_t> halfs(vector.size());
+            std::vector<uint8_t> codes(vector.size());
+            std::vector<float> scales(vector.size() / blockLength), restored(vector.size());
+            report("quantize_f16", sizeName, size, params, measure(minSeconds, none, [&] { quant::toFloat16(vector, halfs); }));
+            report("dequantize_f16", sizeName, size, params, measure(minSeconds, none, [&] { quant::fromFloat16(halfs, restored); }));
+            report("quantize_u8", sizeName, size, params, measure(minSeconds, none, [&] { quant::toUint8(vector, blockLength, codes, scales); }));
+            report("dequantize_u8", sizeName, size, params, measure(minSeconds, none, [&] { quant::fromUint8(codes, scales, blockLength, restored); }));
+
+            // Linear scoring of 64 x 128 windows, with synthetic weights of negative mean so that the cascade
+            // drops most windows at threshold 0
+            cv::Size windowSize(64, 128), windowStride(params.stride, params.stride);
+            std::vector<cv::Point> locations;
+            LinearClassifier classifier;
+            classifier.weights.resize(hog.computeWindows(image, windowSize, windowStride, locations).cols);
+            uint32_t state = 1;
+            for (float& weight : classifier.weights) {
+                state = state * 1664525u + 1013904223u;
+                weight = static_cast<float>(state >> 8) / (1 << 24) * 0.1f - 0.07f;
+            }
+            report("score_windows", sizeName, size, params, measure(minSeconds, none,
+                [&] { hog.scoreWindows(image, classifier, windowSize, windowStride, locations); }));
+            report("score_windows_cascade", sizeName, size, params, measure(minSeconds, none,
+                [&] { hog.scoreWindows(image, classifier, windowSize, windowStride, locations, 0.0f); }));
+
+            // Compact cell features, for the parameter sets with signed bins in opposite pairs
+            if (params.gradType == 360 && params.binNumber % 2 == 0) {
+                hog.setFeatureLayout(HOGDescriptor::FeatureLayout::COMPACT);
+                report("compact_assembly", sizeName, size, params, measure(minSeconds, none, [&] { HOGBenchmark::compactAssembly(hog); }));
+            }
+        }
+    }
+    fs::remove_all(scratch);
+
+    std::ostringstream json;
+    json << "{\n  \"benchmark\": \"hog_bench\",\n  \"threads\": " << ThreadPool::global().size()
+#ifdef __VERSION__
+         << ",\n  \"compiler\": \"" << __VERSION__ << "\""
+#endif
+         << ",\n  \"min_time_s\": " << minSeconds
+         << ",\n  \"results\": [" << results.str() << "\n  ]\n}\n";
+
+    if (outputPath == "-") {
+        std::cout << json.str();
+    } else {
+        std::ofstream file(outputPath);
+        if (!file) {
+            std::cerr << "Error opening file " << outputPath << std::endl;
+            return 1;
+        }
+        file << json.str();
+        std::cerr << "Results saved to " << outputPath << std::endl;
+    }
+    return 0;
+}
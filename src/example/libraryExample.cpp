@@ -1,4 +1,6 @@
 #include <hogdescriptor/hogdescriptor.hpp>
+#include <hogdescriptor/featurestore.hpp>
+#include <hogdescriptor/featurecache.hpp>
 #include <texvisualization/texvisualization.hpp>
 #include "opencv2/imgproc/imgproc.hpp"
 #include "opencv2/highgui/highgui.hpp"
@@ -12,10 +14,49 @@ int main(){
     hog.computeHOG(img);
     hog.visualizeHOG(1, false);
 
+    // Keep the results on disk (up to 1 GB), computing the same image again only maps its entry
+    hog.setFeatureCache(std::make_shared<FeatureCache>("path/to/cache", 1ull << 30));
+    hog.computeHOG(img);
+
+    // Compute on the library thread pool while the caller does other work, e.g. decoding the next image
+    std::future<std::span<const float>> pending = hog.computeHOGAsync(img);
+    cv::Mat next = cv::imread("path/to/next.jpg");
+    std::span<const float> computed = pending.get();
+
     // Save HOG features to .txt file
     hog.saveVectorData("path/to/file", "filename");
 
+    // Append HOG features to a binary feature store and map it back
+    {
+        FeatureStoreWriter store("path/to/features.hogstore", hog, hog.getHOGFeatureView().size());
+        store.append(hog.getHOGFeatureView(), 1);
+    }
+    FeatureStoreReader features("path/to/features.hogstore");
+    cv::Mat samples = features.matrix();
+
+    // Half precision store, half the size, records are converted back with decode
+    {
+        FeatureStoreWriter store("path/to/features16.hogstore", hog, hog.getHOGFeatureView().size(), HOGValueType::FLOAT16);
+        store.append(hog.getHOGFeatureVector(HOGValueType::FLOAT16), 1);
+    }
+
+    // Compact 31-value cell features (Felzenszwalb et al.) from 18 signed bins
+    HOGDescriptor compact(16, 8, 8, 18, 360);
+    compact.setFeatureLayout(HOGDescriptor::FeatureLayout::COMPACT);
+    compact.computeHOG(img);
+    std::span<const float> cellFeatures = compact.getHOGFeatureView();
+
     texHOG plots;
     auto cellhist = hog.getCellHistogram(7, 9);
-    plots.cellHistogramPlot(cellhist, 20, "path/to/folder", 'filename');
+    plots.cellHistogramPlot(cellhist, 20, "path/to/folder", "filename");
+
+    // Descriptors of 64 x 128 windows at a few locations, only the cells under them are computed
+    std::vector<cv::Point> locations = {{16, 16}, {120, 40}};
+    cv::Mat local = hog.computeAt(img, locations, cv::Size(64, 128));
+
+    // Linear SVM scores of every 64 x 128 window, windows that cannot reach 0 are dropped early
+    LinearClassifier svm;
+    svm.weights.assign(3780, 0.0f); // trained weights of the window descriptor
+    std::vector<cv::Point> windows;
+    std::vector<float> scores = hog.scoreWindows(img, svm, cv::Size(64, 128), cv::Size(8, 8), windows, 0.0f);
 }
\ No newline at end of file
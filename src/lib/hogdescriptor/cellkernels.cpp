@@ -0,0 +1,250 @@
+#include "cellkernels.hpp"
+#include <algorithm>
+#include <array>
+#include <cmath>
+
+namespace hogkernels {
+
+namespace {
+
+void accumulateRowGeneric(const float* magnitude, const int* bin, int cells, int cellSize, int binNumber, float* histograms) {
+    for (int cell = 0; cell < cells; ++cell) {
+        for (int i = 0; i < cellSize; ++i) {
+            histograms[bin[i]] += magnitude[i];
+        }
+        histograms += binNumber;
+        magnitude += cellSize;
+        bin += cellSize;
+    }
+}
+
+// Same loop with the sizes known, the cell loop is fully unrolled
+template <int CellSize, int Bins>
+void accumulateRowFixedSize(const float* magnitude, const int* bin, int cells, int, int, float* histograms) {
+    for (int cell = 0; cell < cells; ++cell) {
+        for (int i = 0; i < CellSize; ++i) {
+            histograms[bin[i]] += magnitude[i];
+        }
+        histograms += Bins;
+        magnitude += CellSize;
+        bin += CellSize;
+    }
+}
+
+void accumulateRowFixedGeneric(const uint16_t* magnitude, const uint8_t* bin, int cells, int cellSize, int binNumber, uint32_t* histograms) {
+    for (int cell = 0; cell < cells; ++cell) {
+        for (int i = 0; i < cellSize; ++i) {
+            histograms[bin[i]] += magnitude[i];
+        }
+        histograms += binNumber;
+        magnitude += cellSize;
+        bin += cellSize;
+    }
+}
+
+template <int CellSize, int Bins>
+void accumulateRowFixedFixedSize(const uint16_t* magnitude, const uint8_t* bin, int cells, int, int, uint32_t* histograms) {
+    for (int cell = 0; cell < cells; ++cell) {
+        for (int i = 0; i < CellSize; ++i) {
+            histograms[bin[i]] += magnitude[i];
+        }
+        histograms += Bins;
+        magnitude += CellSize;
+        bin += CellSize;
+    }
+}
+
+void copyBlockGeneric(const float* cells, size_t rowStride, int cellsPerBlock, int binNumber, float* block) {
+    const size_t rowLength = static_cast<size_t>(cellsPerBlock) * binNumber;
+    for (int i = 0; i < cellsPerBlock; ++i) {
+        std::copy(cells + i * rowStride, cells + i * rowStride + rowLength, block + i * rowLength);
+    }
+}
+
+template <int CellsPerBlock, int Bins>
+void copyBlockFixedSize(const float* cells, size_t rowStride, int, int, float* block) {
+    constexpr int rowLength = CellsPerBlock * Bins;
+    for (int i = 0; i < CellsPerBlock; ++i) {
+        for (int j = 0; j < rowLength; ++j) {
+            block[i * rowLength + j] = cells[i * rowStride + j];
+        }
+    }
+}
+
+// Sum (or sum of squares) in eight interleaved partial sums added pairwise at the end.
+// The order is fixed by the length alone, so it vectorizes without reassociation and
+// every kernel using it rounds the same way.
+template <bool Squares>
+inline float laneSum(const float* values, size_t length) {
+    float lanes[8] = {};
+    size_t i = 0;
+    for (; i + 8 <= length; i += 8) {
+        for (size_t lane = 0; lane < 8; ++lane) {
+            lanes[lane] += Squares ? values[i + lane] * values[i + lane] : values[i + lane];
+        }
+    }
+    for (size_t lane = 0; lane < 8 && i + lane < length; ++lane) {
+        lanes[lane] += Squares ? values[i + lane] * values[i + lane] : values[i + lane];
+    }
+    return ((lanes[0] + lanes[4]) + (lanes[1] + lanes[5])) + ((lanes[2] + lanes[6]) + (lanes[3] + lanes[7]));
+}
+
+template <bool Squares>
+void cellEnergyGeneric(const float* histograms, size_t cells, int binNumber, float* energy) {
+    for (size_t cell = 0; cell < cells; ++cell) {
+        energy[cell] = laneSum<Squares>(histograms + cell * binNumber, binNumber);
+    }
+}
+
+template <bool Squares, int Bins>
+void cellEnergyFixedSize(const float* histograms, size_t cells, int, float* energy) {
+    for (size_t cell = 0; cell < cells; ++cell) {
+        energy[cell] = laneSum<Squares>(histograms + cell * Bins, Bins);
+    }
+}
+
+const float NORM_EPS = 1e-5f; // Small constant for numerical stability
+const float CLIP_L2 = 0.5f; // Clipping of L2_CLIPPED
+const float CLIP_L2_HYS = 0.2f; // Clipping of L2_HYS (Dalal and Triggs)
+
+// Every scheme scales by a reciprocal, so the loops are plain vector multiplies
+template <int Norm>
+inline void normalize(float* block, size_t length, float energy) {
+    if constexpr (Norm == NORM_L1) {
+        const float scale = 1.0f / (energy + NORM_EPS);
+        for (size_t i = 0; i < length; ++i) {
+            block[i] *= scale;
+        }
+    } else if constexpr (Norm == NORM_L1_SQRT) {
+        const float scale = 1.0f / (energy + NORM_EPS);
+        for (size_t i = 0; i < length; ++i) {
+            block[i] = std::sqrt(block[i] * scale);
+        }
+    } else if constexpr (Norm == NORM_L2) {
+        const float scale = 1.0f / std::sqrt(energy + NORM_EPS);
+        for (size_t i = 0; i < length; ++i) {
+            block[i] *= scale;
+        }
+    } else if constexpr (Norm == NORM_L2_CLIPPED) {
+        const float scale = 1.0f / std::sqrt(energy + NORM_EPS);
+        for (size_t i = 0; i < length; ++i) {
+            block[i] = std::min(block[i] * scale, CLIP_L2);
+        }
+    } else {
+        // L2, clip, then L2 again over the clipped values
+        const float scale = 1.0f / std::sqrt(energy + NORM_EPS);
+        for (size_t i = 0; i < length; ++i) {
+            block[i] = std::min(block[i] * scale, CLIP_L2_HYS);
+        }
+        const float rescale = 1.0f / std::sqrt(laneSum<true>(block, length) + NORM_EPS);
+        for (size_t i = 0; i < length; ++i) {
+            block[i] *= rescale;
+        }
+    }
+}
+
+template <int Norm>
+void normalizeBlockGeneric(float* block, size_t length, float energy) {
+    normalize<Norm>(block, length, energy);
+}
+
+// Partial blocks (e.g. at the border in visualizeHOG) take the generic loop
+template <int Norm, size_t Length>
+void normalizeBlockFixedSize(float* block, size_t length, float energy) {
+    if (length != Length) {
+        normalize<Norm>(block, length, energy);
+        return;
+    }
+    normalize<Norm>(block, Length, energy);
+}
+
+// Specialized sizes: index 0 is the generic kernel
+const int CELL_SIZES[] = {0, 8, 16};
+const int BIN_NUMBERS[] = {0, 9, 18};
+
+int sizeIndex(const int* sizes, int value) {
+    for (int i = 1; i < 3; ++i) {
+        if (sizes[i] == value) {
+            return i;
+        }
+    }
+    return 0;
+}
+
+template <int CellSize, int Bins>
+void setAccumulate(KernelTable& table) {
+    table.accumulateRow = accumulateRowFixedSize<CellSize, Bins>;
+    table.accumulateRowFixed = accumulateRowFixedFixedSize<CellSize, Bins>;
+}
+
+template <int Norm, int Bins>
+void setBlock(KernelTable& table, bool blocks2x2) {
+    constexpr bool squares = Norm != NORM_L1 && Norm != NORM_L1_SQRT;
+    if constexpr (Bins == 0) {
+        table.cellEnergy = cellEnergyGeneric<squares>;
+        table.normalizeBlock = normalizeBlockGeneric<Norm>;
+    } else {
+        table.cellEnergy = cellEnergyFixedSize<squares, Bins>;
+        table.normalizeBlock = normalizeBlockGeneric<Norm>;
+        if (blocks2x2) {
+            table.copyBlock = copyBlockFixedSize<2, Bins>;
+            table.normalizeBlock = normalizeBlockFixedSize<Norm, 4 * Bins>;
+        }
+    }
+}
+
+template <int Norm>
+void setNorm(KernelTable& table, int binIndex, bool blocks2x2) {
+    switch (binIndex) {
+        case 1: setBlock<Norm, 9>(table, blocks2x2); break;
+        case 2: setBlock<Norm, 18>(table, blocks2x2); break;
+        default: setBlock<Norm, 0>(table, blocks2x2); break;
+    }
+}
+
+KernelTable makeTable(int cellIndex, int binIndex, bool blocks2x2, bool signedGradient, int normType) {
+    KernelTable table{gradientRow(signedGradient), accumulateRowGeneric, accumulateRowFixedGeneric,
+                      copyBlockGeneric, nullptr, nullptr};
+    switch (cellIndex * 3 + binIndex) {
+        case 1 * 3 + 1: setAccumulate<8, 9>(table); break;
+        case 1 * 3 + 2: setAccumulate<8, 18>(table); break;
+        case 2 * 3 + 1: setAccumulate<16, 9>(table); break;
+        case 2 * 3 + 2: setAccumulate<16, 18>(table); break;
+        default: break;
+    }
+    switch (normType) {
+        case NORM_L1: setNorm<NORM_L1>(table, binIndex, blocks2x2); break;
+        case NORM_L1_SQRT: setNorm<NORM_L1_SQRT>(table, binIndex, blocks2x2); break;
+        case NORM_L2: setNorm<NORM_L2>(table, binIndex, blocks2x2); break;
+        case NORM_L2_HYS: setNorm<NORM_L2_HYS>(table, binIndex, blocks2x2); break;
+        default: setNorm<NORM_L2_CLIPPED>(table, binIndex, blocks2x2); break;
+    }
+    return table;
+}
+
+} // namespace
+
+const KernelTable* selectKernels(int cellSize, int binNumber, int cellsPerBlock, bool signedGradient, int normType) {
+    // [norm][cell size][bin number][2 x 2 blocks][signed]
+    static const std::array<KernelTable, NORM_COUNT * 36> tables = [] {
+        std::array<KernelTable, NORM_COUNT * 36> all{};
+        for (int norm = 0; norm < NORM_COUNT; ++norm) {
+            for (int cell = 0; cell < 3; ++cell) {
+                for (int bins = 0; bins < 3; ++bins) {
+                    for (int block = 0; block < 2; ++block) {
+                        for (int sign = 0; sign < 2; ++sign) {
+                            all[(((norm * 3 + cell) * 3 + bins) * 2 + block) * 2 + sign] = makeTable(cell, bins, block, sign, norm);
+                        }
+                    }
+                }
+            }
+        }
+        return all;
+    }();
+    int cell = sizeIndex(CELL_SIZES, cellSize);
+    int bins = sizeIndex(BIN_NUMBERS, binNumber);
+    int block = cellsPerBlock == 2;
+    return &tables[(((normType * 3 + cell) * 3 + bins) * 2 + block) * 2 + signedGradient];
+}
+
+} // namespace hogkernels
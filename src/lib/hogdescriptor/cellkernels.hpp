@@ -0,0 +1,103 @@
+#ifndef HOGDESCRIPTOR_CELLKERNELS_H
+#define HOGDESCRIPTOR_CELLKERNELS_H
+
+#include "gradientkernels.hpp"
+#include <cstddef>
+#include <cstdint>
+
+namespace hogkernels {
+
+/**
+ * @brief Kernel adding one pixel row of consecutive cells to their histograms
+ *
+ * @param magnitude Gradient magnitude of each pixel of the row
+ * @param bin Orientation bin of each pixel of the row
+ * @param cells Number of cells in the row
+ * @param cellSize Size of the cell in pixels
+ * @param binNumber Number of the bins in each histogram
+ * @param histograms Histograms of the cells, binNumber values each
+ */
+using AccumulateRowFn = void (*)(const float* magnitude, const int* bin, int cells, int cellSize, int binNumber, float* histograms);
+
+/**
+ * @brief Integer version of AccumulateRowFn for the fixed-point pipeline
+ */
+using AccumulateRowFixedFn = void (*)(const uint16_t* magnitude, const uint8_t* bin, int cells, int cellSize, int binNumber, uint32_t* histograms);
+
+/**
+ * @brief Kernel gathering the cell histograms of one block into a contiguous block vector
+ *
+ * @param cells Histograms of the top-left cell of the block, cells of a block row follow each other
+ * @param rowStride Number of values between two cell rows
+ * @param cellsPerBlock Number of cells of the block in each direction
+ * @param binNumber Number of the bins in each histogram
+ * @param block Output block vector
+ */
+using CopyBlockFn = void (*)(const float* cells, size_t rowStride, int cellsPerBlock, int binNumber, float* block);
+
+/**
+ * @brief Block normalization schemes, in the order of HOGDescriptor::NormType
+ */
+enum NormIndex {
+    NORM_L2_CLIPPED, //!< L2, then clipping at 0.5
+    NORM_L1, //!< L1
+    NORM_L1_SQRT, //!< Square root of L1
+    NORM_L2, //!< L2
+    NORM_L2_HYS, //!< L2, clipping at 0.2, then L2 again
+    NORM_COUNT
+};
+
+/**
+ * @brief Kernel computing the energy of consecutive cell histograms
+ *
+ * The energy is the sum of squares for the L2 schemes and the sum for the L1 schemes
+ * (bins are non-negative). The energy of a block is the sum of the energies of its cells
+ * in block order, so each cell is reduced once however many blocks hold it.
+ *
+ * @param histograms Histograms of the cells, binNumber values each
+ * @param cells Number of cells
+ * @param binNumber Number of the bins in each histogram
+ * @param energy Output energy of each cell
+ */
+using CellEnergyFn = void (*)(const float* histograms, size_t cells, int binNumber, float* energy);
+
+/**
+ * @brief Kernel normalizing a block vector in place
+ *
+ * @param block Block vector
+ * @param length Number of values in the block
+ * @param energy Sum of the energies of the cells of the block
+ */
+using NormalizeBlockFn = void (*)(float* block, size_t length, float energy);
+
+/**
+ * @brief Kernels of one parameter set
+ *
+ * Common parameter sets (8 or 16 pixel cells, 9 or 18 bins, 2 x 2 cell blocks, signed or unsigned)
+ * get kernels with the sizes as compile-time constants, the others the generic loops,
+ * for each normalization scheme.
+ * Every kernel gives bit-identical results to the generic one.
+ */
+struct KernelTable {
+    GradientRowFn gradientRow; //!< Fused gradient and orientation kernel of the gradient type
+    AccumulateRowFn accumulateRow; //!< Cell histogram accumulation
+    AccumulateRowFixedFn accumulateRowFixed; //!< Cell histogram accumulation of the integer pipeline
+    CopyBlockFn copyBlock; //!< Block gathering
+    CellEnergyFn cellEnergy; //!< Cell energies of the normalization scheme
+    NormalizeBlockFn normalizeBlock; //!< Block normalization
+};
+
+/**
+ * @brief Kernel table of a parameter set, the tables are built once and shared
+ *
+ * @param cellSize Size of the cell in pixels
+ * @param binNumber Number of the bins in each histogram
+ * @param cellsPerBlock Number of cells of a block in each direction
+ * @param signedGradient True for 360 degree spread, false for 180
+ * @param normType Block normalization scheme, one of NormIndex
+ */
+const KernelTable* selectKernels(int cellSize, int binNumber, int cellsPerBlock, bool signedGradient, int normType);
+
+} // namespace hogkernels
+
+#endif //HOGDESCRIPTOR_CELLKERNELS_H
@@ -0,0 +1,393 @@
+#include "include/hogdescriptor/featurecache.hpp"
+#include "include/hogdescriptor/mappedfile.hpp"
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <stdexcept>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+const char ENTRY_MAGIC[8] = {'H', 'O', 'G', 'C', 'A', 'C', 'H', 'E'};
+const uint32_t ENTRY_VERSION = 1;
+const char* const ENTRY_EXTENSION = ".hogc";
+
+// An eviction brings the entries down to this share of the cap, so that the directory is listed
+// again only after another tenth of the cap has been written
+const uint64_t EVICTION_TARGET_PERCENT = 90;
+
+// A hit refreshes the modification time of its file only if the last refresh is older than this,
+// the use order across processes has this resolution and most hits write no metadata
+const std::chrono::seconds TIME_REFRESH_INTERVAL(60);
+
+// Temporary files older than this were left by a process that died while writing
+const std::chrono::minutes TEMPORARY_MAX_AGE(10);
+
+/**
+ * @brief Header of a cache entry file, followed by the cell histograms and the feature vector as floats
+ */
+struct EntryHeader {
+    char magic[8]; //!< "HOGCACHE"
+    uint32_t version; //!< Format version
+    uint32_t headerSize; //!< Size of the header in bytes
+    uint64_t key; //!< Key of the entry
+    int32_t rows; //!< Number of cells in the vertical direction
+    int32_t cols; //!< Number of cells in the horizontal direction
+    int32_t bins; //!< Number of the bins in each histogram
+    uint32_t reserved; //!< Zero
+    uint64_t vectorLength; //!< Number of values of the feature vector
+    uint64_t padding[2]; //!< Zero, the values start 64 bytes in
+};
+
+// The mapped values are used as native floats
+static_assert(std::endian::native == std::endian::little, "Feature cache entries are little-endian");
+static_assert(sizeof(EntryHeader) == 64, "Feature cache entry header must take 64 bytes");
+
+// XXH64 (Yann Collet), the 64-bit hash behind the keys, some 10 GB/s on current CPUs
+const uint64_t PRIME1 = 11400714785074694791ull;
+const uint64_t PRIME2 = 14029467366897019727ull;
+const uint64_t PRIME3 = 1609587929392839161ull;
+const uint64_t PRIME4 = 9650029242287828579ull;
+const uint64_t PRIME5 = 2870177450012600261ull;
+
+inline uint64_t read64(const uint8_t* bytes){
+    uint64_t value;
+    std::memcpy(&value, bytes, sizeof(value));
+    return value;
+}
+
+inline uint32_t read32(const uint8_t* bytes){
+    uint32_t value;
+    std::memcpy(&value, bytes, sizeof(value));
+    return value;
+}
+
+inline uint64_t hashRound(uint64_t accumulator, uint64_t input){
+    return std::rotl(accumulator + input * PRIME2, 31) * PRIME1;
+}
+
+inline uint64_t mergeRound(uint64_t hash, uint64_t accumulator){
+    return (hash ^ hashRound(0, accumulator)) * PRIME1 + PRIME4;
+}
+
+uint64_t hashBytes(const void* data, size_t length, uint64_t seed){
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    const uint8_t* end = bytes + length;
+    uint64_t hash;
+
+    // Four independent lanes over 32-byte stripes
+    if (length >= 32) {
+        uint64_t v1 = seed + PRIME1 + PRIME2, v2 = seed + PRIME2, v3 = seed, v4 = seed - PRIME1;
+        for (; bytes + 32 <= end; bytes += 32) {
+            v1 = hashRound(v1, read64(bytes));
+            v2 = hashRound(v2, read64(bytes + 8));
+            v3 = hashRound(v3, read64(bytes + 16));
+            v4 = hashRound(v4, read64(bytes + 24));
+        }
+        hash = std::rotl(v1, 1) + std::rotl(v2, 7) + std::rotl(v3, 12) + std::rotl(v4, 18);
+        hash = mergeRound(mergeRound(mergeRound(mergeRound(hash, v1), v2), v3), v4);
+    } else {
+        hash = seed + PRIME5;
+    }
+    hash += length;
+
+    for (; bytes + 8 <= end; bytes += 8) {
+        hash = std::rotl(hash ^ hashRound(0, read64(bytes)), 27) * PRIME1 + PRIME4;
+    }
+    if (bytes + 4 <= end) {
+        hash = std::rotl(hash ^ (read32(bytes) * PRIME1), 23) * PRIME2 + PRIME3;
+        bytes += 4;
+    }
+    for (; bytes < end; bytes++) {
+        hash = std::rotl(hash ^ (*bytes * PRIME5), 11) * PRIME1;
+    }
+
+    hash ^= hash >> 33;
+    hash *= PRIME2;
+    hash ^= hash >> 29;
+    hash *= PRIME3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+std::string hex(uint64_t value){
+    char digits[17];
+    std::snprintf(digits, sizeof(digits), "%016llx", static_cast<unsigned long long>(value));
+    return digits;
+}
+
+// Key of an entry file name, false for the other files of the directory
+bool parseKey(const fs::path& path, uint64_t& key){
+    std::string stem = path.stem().string();
+    if (path.extension() != ENTRY_EXTENSION || stem.size() != 16 ||
+        stem.find_first_not_of("0123456789abcdef") != std::string::npos) {
+        return false;
+    }
+    key = std::stoull(stem, nullptr, 16);
+    return true;
+}
+
+// True for the temporary files of store, "<key>.hogc.<tag>.tmp"
+bool isTemporary(const fs::path& path){
+    std::string name = path.filename().string();
+    const std::string prefix = std::string(".") + (ENTRY_EXTENSION + 1) + ".";
+    return path.extension() == ".tmp" && name.size() == 16 + prefix.size() + 16 + 4 &&
+        name.compare(16, prefix.size(), prefix) == 0;
+}
+
+} // namespace
+
+FeatureCache::FeatureCache(const std::string& directory, uint64_t maxBytes)
+    : directory_(directory), maxBytes_(maxBytes), tag_(std::random_device{}()){
+    std::error_code error;
+    fs::create_directories(directory_, error);
+    if (!fs::is_directory(directory_)) {
+        throw std::runtime_error("Error opening the feature cache!");
+    }
+
+    // Entries left by earlier runs count towards the cap
+    std::lock_guard<std::mutex> lock(mutex_);
+    scan();
+    if (bytes_ > maxBytes_) {
+        evict();
+    }
+}
+
+uint64_t FeatureCache::key(const cv::Mat& image, std::span<const int64_t> settings){
+    // The geometry, type and settings seed the hash of the pixels, chained row by row so that
+    // a region of a larger image gets the key of its copy
+    std::vector<int64_t> seed = {ENTRY_VERSION, image.rows, image.cols, image.type()};
+    seed.insert(seed.end(), settings.begin(), settings.end());
+    uint64_t hash = hashBytes(seed.data(), seed.size() * sizeof(int64_t), 0);
+    const size_t rowBytes = image.cols * image.elemSize();
+    for (int y = 0; y < image.rows; ++y) {
+        hash = hashBytes(image.ptr(y), rowBytes, hash);
+    }
+    return hash;
+}
+
+std::string FeatureCache::entryPath(uint64_t key) const {
+    return (fs::path(directory_) / (hex(key) + ENTRY_EXTENSION)).string();
+}
+
+bool FeatureCache::load(uint64_t key, CellHistograms& cellHistograms, std::vector<float>& featureVector){
+    // A missing entry fails to open, no separate lookup
+    const std::string path = entryPath(key);
+    uint64_t bytes;
+    try {
+        MappedFile file(path, "feature cache entry");
+        const EntryHeader* header = reinterpret_cast<const EntryHeader*>(file.data());
+        bytes = file.size();
+        size_t histogramValues = 0;
+        bool valid = bytes >= sizeof(EntryHeader) && std::memcmp(header->magic, ENTRY_MAGIC, sizeof(ENTRY_MAGIC)) == 0 &&
+            header->version == ENTRY_VERSION && header->headerSize == sizeof(EntryHeader) && header->key == key &&
+            header->rows >= 0 && header->cols >= 0 && header->bins > 0;
+        if (valid) {
+            histogramValues = static_cast<size_t>(header->rows) * header->cols * header->bins;
+            valid = bytes == sizeof(EntryHeader) + (histogramValues + header->vectorLength) * sizeof(float);
+        }
+        if (!valid) {
+            erase(key);
+            misses_++;
+            return false;
+        }
+
+        const float* values = reinterpret_cast<const float*>(file.data() + sizeof(EntryHeader));
+        cellHistograms.reshape(header->rows, header->cols, header->bins);
+        std::memcpy(cellHistograms.data(), values, histogramValues * sizeof(float));
+        featureVector.resize(header->vectorLength);
+        std::memcpy(featureVector.data(), values + histogramValues, header->vectorLength * sizeof(float));
+    } catch (const std::runtime_error&) {
+        // Never written, or deleted by another process
+        misses_++;
+        return false;
+    }
+
+    if (touch(key, bytes)) {
+        std::error_code error;
+        fs::last_write_time(path, fs::file_time_type::clock::now(), error);
+    }
+    hits_++;
+    return true;
+}
+
+bool FeatureCache::store(uint64_t key, const CellHistograms& cellHistograms, std::span<const float> featureVector){
+    const uint64_t bytes = sizeof(EntryHeader) + (cellHistograms.size() + featureVector.size()) * sizeof(float);
+    if (bytes > maxBytes_) {
+        return false;
+    }
+
+    EntryHeader header = {};
+    std::memcpy(header.magic, ENTRY_MAGIC, sizeof(ENTRY_MAGIC));
+    header.version = ENTRY_VERSION;
+    header.headerSize = sizeof(EntryHeader);
+    header.key = key;
+    header.rows = cellHistograms.rows();
+    header.cols = cellHistograms.cols();
+    header.bins = cellHistograms.bins();
+    header.vectorLength = featureVector.size();
+
+    // Readers only ever see complete entries: the file is written under a name of its own, then renamed
+    const std::string path = entryPath(key);
+    const std::string temporary = path + "." + hex(tag_ + temporaries_++) + ".tmp";
+    std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char*>(cellHistograms.data()), static_cast<std::streamsize>(cellHistograms.size() * sizeof(float)));
+    file.write(reinterpret_cast<const char*>(featureVector.data()), static_cast<std::streamsize>(featureVector.size_bytes()));
+    file.close();
+    std::error_code error;
+    if (!file.good()) {
+        fs::remove(temporary, error);
+        return false;
+    }
+    fs::rename(temporary, path, error);
+    if (error) {
+        fs::remove(temporary, error);
+        return false;
+    }
+
+    // The new entry is the most recently used one, its file was just written, the directory is only
+    // listed again beyond the cap
+    touch(key, bytes);
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (bytes_ > maxBytes_) {
+        evict();
+    }
+    return true;
+}
+
+bool FeatureCache::touch(uint64_t key, uint64_t bytes){
+    const fs::file_time_type now = fs::file_time_type::clock::now();
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto entry = entries_.find(key);
+    if (entry != entries_.end()) {
+        useOrder_.splice(useOrder_.begin(), useOrder_, entry->second.use);
+        bytes_ += bytes - entry->second.bytes;
+        entry->second.bytes = bytes;
+        entry->second.used = now;
+        if (now - entry->second.fileTime < TIME_REFRESH_INTERVAL) {
+            return false;
+        }
+        entry->second.fileTime = now;
+        return true;
+    }
+    useOrder_.push_front(key);
+    entries_[key] = {useOrder_.begin(), bytes, now, now};
+    bytes_ += bytes;
+    return true;
+}
+
+void FeatureCache::erase(uint64_t key){
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto entry = entries_.find(key);
+        if (entry != entries_.end()) {
+            bytes_ -= entry->second.bytes;
+            useOrder_.erase(entry->second.use);
+            entries_.erase(entry);
+        }
+    }
+    std::error_code error;
+    fs::remove(entryPath(key), error);
+}
+
+void FeatureCache::scan(){
+    // Loads refresh the modification time, so the files of every process sharing the directory
+    // sort from the least to the most recently used, to the minute
+    struct Found {
+        fs::file_time_type used;
+        fs::file_time_type fileTime;
+        uint64_t key;
+        uint64_t bytes;
+    };
+    std::vector<Found> found;
+    std::error_code error;
+    // Temporary files being written count towards the cap, the ones of dead processes are deleted
+    const fs::file_time_type staleBefore = fs::file_time_type::clock::now() - TEMPORARY_MAX_AGE;
+    uint64_t temporaryBytes = 0;
+    for (const fs::directory_entry& file : fs::directory_iterator(directory_, error)) {
+        uint64_t key;
+        if (!file.is_regular_file(error)) {
+            continue;
+        }
+        if (parseKey(file.path(), key)) {
+            uint64_t bytes = file.file_size(error);
+            fs::file_time_type time = file.last_write_time(error);
+            if (!error) {
+                found.push_back({time, time, key, bytes});
+            }
+        } else if (isTemporary(file.path())) {
+            uint64_t bytes = file.file_size(error);
+            fs::file_time_type time = file.last_write_time(error);
+            if (error) {
+                continue;
+            }
+            if (time < staleBefore) {
+                fs::remove(file.path(), error);
+            } else {
+                temporaryBytes += bytes;
+            }
+        }
+    }
+    // Uses of this object not yet written to the file times still count
+    for (Found& entry : found) {
+        auto known = entries_.find(entry.key);
+        if (known != entries_.end()) {
+            entry.used = std::max(entry.used, known->second.used);
+        }
+    }
+    std::sort(found.begin(), found.end(), [](const Found& a, const Found& b) { return a.used < b.used; });
+
+    useOrder_.clear();
+    entries_.clear();
+    bytes_ = temporaryBytes;
+    for (const Found& entry : found) {
+        useOrder_.push_front(entry.key);
+        entries_[entry.key] = {useOrder_.begin(), entry.bytes, entry.used, entry.fileTime};
+        bytes_ += entry.bytes;
+    }
+}
+
+void FeatureCache::evict(){
+    // Other processes sharing the directory wrote entries this index does not know about
+    scan();
+    const uint64_t target = maxBytes_ / 100 * EVICTION_TARGET_PERCENT;
+    std::error_code error;
+    while (bytes_ > target && !useOrder_.empty()) {
+        uint64_t key = useOrder_.back();
+        fs::remove(entryPath(key), error);
+        bytes_ -= entries_[key].bytes;
+        entries_.erase(key);
+        useOrder_.pop_back();
+    }
+}
+
+void FeatureCache::clear(){
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::error_code error;
+    for (const fs::directory_entry& file : fs::directory_iterator(directory_, error)) {
+        uint64_t key;
+        if (parseKey(file.path(), key)) {
+            fs::remove(file.path(), error);
+        }
+    }
+    useOrder_.clear();
+    entries_.clear();
+    bytes_ = 0;
+}
+
+uint64_t FeatureCache::bytes() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return bytes_;
+}
+
+size_t FeatureCache::count() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return entries_.size();
+}
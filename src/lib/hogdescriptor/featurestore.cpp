@@ -0,0 +1,342 @@
+#include "include/hogdescriptor/featurestore.hpp"
+#include <bit>
+#include <cstring>
+#include <filesystem>
+#include <stdexcept>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+const char STORE_MAGIC[8] = {'H', 'O', 'G', 'S', 'T', 'O', 'R', 'E'};
+const uint32_t STORE_VERSION = 3;
+
+// The mapped records are used as native floats
+static_assert(std::endian::native == std::endian::little, "Feature stores are little-endian");
+static_assert(sizeof(FeatureStoreHeader) == 64, "Feature store header must take 64 bytes");
+
+void checkHeader(const FeatureStoreHeader& header){
+    if (std::memcmp(header.magic, STORE_MAGIC, sizeof(STORE_MAGIC)) != 0) {
+        throw std::runtime_error("Not a feature store file!");
+    }
+    if (header.version != STORE_VERSION || header.headerSize != sizeof(FeatureStoreHeader)) {
+        throw std::runtime_error("Unsupported feature store version!");
+    }
+    if (header.valueType > static_cast<uint32_t>(HOGValueType::UINT8)) {
+        throw std::runtime_error("Unsupported feature store value type!");
+    }
+    if (header.layout > static_cast<uint8_t>(HOGDescriptor::FeatureLayout::COMPACT) ||
+        header.normType > static_cast<uint8_t>(HOGDescriptor::NormType::L2_HYS)) {
+        throw std::runtime_error("Unsupported feature store layout!");
+    }
+    if (header.indexOffset == 0) {
+        throw std::runtime_error("The feature store was not closed!");
+    }
+}
+
+// Number of values sharing one scale in UINT8 records: one block of the descriptor, or one cell
+// of the compact layout, as the groups of HOGDescriptor::getHOGFeatureVector
+size_t groupLength(const FeatureStoreHeader& header){
+    if (header.binNumber <= 0) {
+        return 0;
+    }
+    if (header.layout == static_cast<uint8_t>(HOGDescriptor::FeatureLayout::COMPACT)) {
+        return static_cast<size_t>(header.binNumber + header.binNumber / 2 + 4);
+    }
+    if (header.cellSize <= 0 || header.blockSize < header.cellSize) {
+        return 0;
+    }
+    size_t cellsPerBlock = static_cast<size_t>(header.blockSize / header.cellSize);
+    return cellsPerBlock * cellsPerBlock * static_cast<size_t>(header.binNumber);
+}
+
+const size_t RECORD_ALIGNMENT = 64;
+
+// Every record is padded to a multiple of 64 bytes, so each one starts on a cache line
+// and the rows of the mapped matrix are aligned for SIMD loads
+size_t recordSize(const FeatureStoreHeader& header){
+    size_t length = header.vectorLength;
+    size_t bytes;
+    switch (static_cast<HOGValueType>(header.valueType)) {
+    case HOGValueType::FLOAT16:
+        bytes = length * sizeof(uint16_t);
+        break;
+    case HOGValueType::UINT8:
+        bytes = length / groupLength(header) * sizeof(float) + length;
+        break;
+    default:
+        bytes = length * sizeof(float);
+        break;
+    }
+    return (bytes + RECORD_ALIGNMENT - 1) / RECORD_ALIGNMENT * RECORD_ALIGNMENT;
+}
+
+template <typename T>
+std::span<const std::byte> bytesOf(const std::vector<T>& values){
+    return std::as_bytes(std::span<const T>(values));
+}
+
+} // namespace
+
+FeatureStoreWriter::FeatureStoreWriter(const std::string& path, const HOGParameters& params, size_t vectorLength, HOGValueType valueType,
+                                       HOGDescriptor::FeatureLayout layout, HOGDescriptor::NormType normType){
+    if (vectorLength == 0) {
+        throw std::invalid_argument("FeatureStoreWriter: vectorLength must be > 0");
+    }
+    if (valueType > HOGValueType::UINT8) {
+        throw std::invalid_argument("FeatureStoreWriter: unknown value type");
+    }
+    if (layout == HOGDescriptor::FeatureLayout::COMPACT && (params.gradType != static_cast<int>(HOGDescriptor::GRADIENT_SIGNED) || params.binNumber % 2 != 0)) {
+        throw std::invalid_argument("FeatureStoreWriter: the compact layout needs signed gradients and an even binNumber");
+    }
+
+    if (fs::exists(path)) {
+        // Append: keep the records, the index is read back and rewritten after the new records
+        file_.open(path, std::ios::in | std::ios::out | std::ios::binary);
+        if (!file_ || !file_.read(reinterpret_cast<char*>(&header_), sizeof(header_))) {
+            throw std::runtime_error("Error opening the feature store!");
+        }
+        checkHeader(header_);
+        HOGParameters stored{header_.blockSize, header_.cellSize, header_.stride, header_.binNumber, header_.gradType};
+        if (!(stored == params) || header_.vectorLength != vectorLength || header_.valueType != static_cast<uint32_t>(valueType) ||
+            header_.layout != static_cast<uint8_t>(layout) || header_.normType != static_cast<uint8_t>(normType)) {
+            throw std::invalid_argument("FeatureStoreWriter: parameters differ from the existing store");
+        }
+        groupLength_ = groupLength(header_);
+        recordSize_ = recordSize(header_);
+        labels_.resize(header_.count);
+        file_.seekg(static_cast<std::streamoff>(header_.indexOffset));
+        if (!file_.read(reinterpret_cast<char*>(labels_.data()), static_cast<std::streamsize>(labels_.size() * sizeof(int64_t)))) {
+            throw std::runtime_error("Error reading the feature store index!");
+        }
+        // The new records overwrite the old index: invalidate the header on disk first, so an
+        // interrupted append is recognised like an interrupted new store
+        FeatureStoreHeader open = header_;
+        open.indexOffset = 0;
+        file_.seekp(0);
+        if (!file_.write(reinterpret_cast<const char*>(&open), sizeof(open)) || !file_.flush()) {
+            throw std::runtime_error("Error opening the feature store!");
+        }
+        file_.seekp(static_cast<std::streamoff>(header_.headerSize + header_.count * recordSize_));
+    } else {
+        file_.open(path, std::ios::out | std::ios::binary | std::ios::trunc);
+        if (!file_) {
+            throw std::runtime_error("Error creating the feature store!");
+        }
+        header_ = {};
+        std::memcpy(header_.magic, STORE_MAGIC, sizeof(STORE_MAGIC));
+        header_.version = STORE_VERSION;
+        header_.headerSize = sizeof(FeatureStoreHeader);
+        header_.blockSize = params.blockSize;
+        header_.cellSize = params.cellSize;
+        header_.stride = params.stride;
+        header_.binNumber = params.binNumber;
+        header_.gradType = params.gradType;
+        header_.valueType = static_cast<uint16_t>(valueType);
+        header_.layout = static_cast<uint8_t>(layout);
+        header_.normType = static_cast<uint8_t>(normType);
+        header_.vectorLength = vectorLength;
+        groupLength_ = groupLength(header_);
+        if (valueType == HOGValueType::UINT8 && (groupLength_ == 0 || vectorLength % groupLength_ != 0)) {
+            throw std::invalid_argument("FeatureStoreWriter: UINT8 records must hold whole blocks or compact cells");
+        }
+        recordSize_ = recordSize(header_);
+        // indexOffset stays 0 until close, so an interrupted store is recognised
+        file_.write(reinterpret_cast<const char*>(&header_), sizeof(header_));
+    }
+}
+
+FeatureStoreWriter::FeatureStoreWriter(const std::string& path, const HOGDescriptor& hog, size_t vectorLength, HOGValueType valueType)
+    : FeatureStoreWriter(path, hog.getParameters(), vectorLength, valueType, hog.getFeatureLayout(), hog.getNormType()){
+}
+
+FeatureStoreWriter::~FeatureStoreWriter(){
+    try {
+        close();
+    } catch (const std::exception& e) {
+        std::cerr << "Error closing the feature store: " << e.what() << std::endl;
+    }
+}
+
+void FeatureStoreWriter::append(std::span<const float> features, int64_t label){
+    if (!file_.is_open()) {
+        throw std::runtime_error("The feature store is closed!");
+    }
+    if (features.size() != header_.vectorLength) {
+        throw std::invalid_argument("FeatureStoreWriter: feature vector length differs from the store");
+    }
+
+    switch (static_cast<HOGValueType>(header_.valueType)) {
+    case HOGValueType::FLOAT32:
+        writeRecord({std::as_bytes(features)}, label);
+        break;
+    case HOGValueType::FLOAT16:
+        scratch_.type = HOGValueType::FLOAT16;
+        scratch_.halfs.resize(features.size());
+        quant::toFloat16(features, scratch_.halfs);
+        writeRecord({bytesOf(scratch_.halfs)}, label);
+        break;
+    case HOGValueType::UINT8:
+        scratch_.type = HOGValueType::UINT8;
+        scratch_.codes.resize(features.size());
+        scratch_.scales.resize(features.size() / groupLength_);
+        quant::toUint8(features, groupLength_, scratch_.codes, scratch_.scales);
+        writeRecord({bytesOf(scratch_.scales), bytesOf(scratch_.codes)}, label);
+        break;
+    }
+}
+
+void FeatureStoreWriter::append(const QuantizedVector& features, int64_t label){
+    if (!file_.is_open()) {
+        throw std::runtime_error("The feature store is closed!");
+    }
+    if (static_cast<uint32_t>(features.type) != header_.valueType) {
+        throw std::invalid_argument("FeatureStoreWriter: value type differs from the store");
+    }
+    if (features.size() != header_.vectorLength) {
+        throw std::invalid_argument("FeatureStoreWriter: feature vector length differs from the store");
+    }
+
+    if (features.type == HOGValueType::FLOAT16) {
+        writeRecord({bytesOf(features.halfs)}, label);
+    } else {
+        if (features.groupLength != groupLength_ || features.scales.size() != features.codes.size() / groupLength_) {
+            throw std::invalid_argument("FeatureStoreWriter: UINT8 groups must be the blocks, or the compact cells, of the descriptor");
+        }
+        writeRecord({bytesOf(features.scales), bytesOf(features.codes)}, label);
+    }
+}
+
+void FeatureStoreWriter::writeRecord(std::initializer_list<std::span<const std::byte>> parts, int64_t label){
+    static const char padding[RECORD_ALIGNMENT] = {};
+    size_t written = 0;
+    for (std::span<const std::byte> part : parts) {
+        file_.write(reinterpret_cast<const char*>(part.data()), static_cast<std::streamsize>(part.size()));
+        written += part.size();
+    }
+    file_.write(padding, static_cast<std::streamsize>(recordSize_ - written));
+    labels_.push_back(label);
+}
+
+void FeatureStoreWriter::append(const cv::Mat& features, std::span<const int64_t> labels){
+    if (features.type() != CV_32FC1 || static_cast<size_t>(features.cols) != header_.vectorLength) {
+        throw std::invalid_argument("FeatureStoreWriter: features must be a CV_32F matrix with vectorLength columns");
+    }
+    if (!labels.empty() && labels.size() != static_cast<size_t>(features.rows)) {
+        throw std::invalid_argument("FeatureStoreWriter: one label per row is required");
+    }
+    for (int i = 0; i < features.rows; ++i) {
+        append(std::span<const float>(features.ptr<float>(i), header_.vectorLength), labels.empty() ? 0 : labels[i]);
+    }
+}
+
+void FeatureStoreWriter::close(){
+    if (!file_.is_open()) {
+        return;
+    }
+
+    // Index after the last record, then the header that makes it valid
+    header_.count = labels_.size();
+    header_.indexOffset = header_.headerSize + header_.count * recordSize_;
+    file_.seekp(static_cast<std::streamoff>(header_.indexOffset));
+    file_.write(reinterpret_cast<const char*>(labels_.data()), static_cast<std::streamsize>(labels_.size() * sizeof(int64_t)));
+    file_.seekp(0);
+    file_.write(reinterpret_cast<const char*>(&header_), sizeof(header_));
+    bool good = file_.good();
+    file_.close();
+    if (!good) {
+        throw std::runtime_error("Error writing the feature store!");
+    }
+}
+
+FeatureStoreReader::FeatureStoreReader(const std::string& path)
+    : file_(path, "feature store"), data_(file_.data()), length_(file_.size()){
+    header_ = reinterpret_cast<const FeatureStoreHeader*>(data_);
+    if (length_ < sizeof(FeatureStoreHeader)) {
+        throw std::runtime_error("Not a feature store file!");
+    }
+    checkHeader(*header_);
+    groupLength_ = groupLength(*header_);
+    if (header_->valueType == static_cast<uint32_t>(HOGValueType::UINT8) && (groupLength_ == 0 || header_->vectorLength % groupLength_ != 0)) {
+        throw std::runtime_error("Not a feature store file!");
+    }
+    recordSize_ = recordSize(*header_);
+    if (header_->headerSize + header_->count * recordSize_ > header_->indexOffset
+        || header_->indexOffset + header_->count * sizeof(int64_t) > length_) {
+        throw std::runtime_error("The feature store is truncated!");
+    }
+}
+
+HOGParameters FeatureStoreReader::parameters() const {
+    return {header_->blockSize, header_->cellSize, header_->stride, header_->binNumber, header_->gradType};
+}
+
+std::span<const float> FeatureStoreReader::operator[](size_t i) const {
+    if (i >= size()) {
+        throw std::out_of_range("FeatureStoreReader: record index out of range");
+    }
+    if (valueType() != HOGValueType::FLOAT32) {
+        throw std::runtime_error("The feature store is quantized, decode its records!");
+    }
+    const float* record = reinterpret_cast<const float*>(data_ + header_->headerSize + i * recordSize_);
+    return {record, header_->vectorLength};
+}
+
+void FeatureStoreReader::decode(size_t i, std::span<float> features) const {
+    if (i >= size()) {
+        throw std::out_of_range("FeatureStoreReader: record index out of range");
+    }
+    if (features.size() != vectorLength()) {
+        throw std::invalid_argument("FeatureStoreReader: output length differs from the store");
+    }
+
+    const uint8_t* record = data_ + header_->headerSize + i * recordSize_;
+    switch (valueType()) {
+    case HOGValueType::FLOAT32:
+        std::memcpy(features.data(), record, features.size_bytes());
+        break;
+    case HOGValueType::FLOAT16:
+        quant::fromFloat16(std::span<const uint16_t>(reinterpret_cast<const uint16_t*>(record), vectorLength()), features);
+        break;
+    case HOGValueType::UINT8: {
+        size_t groups = vectorLength() / groupLength_;
+        std::span<const float> scales(reinterpret_cast<const float*>(record), groups);
+        std::span<const uint8_t> codes(record + groups * sizeof(float), vectorLength());
+        quant::fromUint8(codes, scales, groupLength_, features);
+        break;
+    }
+    }
+}
+
+int64_t FeatureStoreReader::label(size_t i) const {
+    if (i >= size()) {
+        throw std::out_of_range("FeatureStoreReader: record index out of range");
+    }
+    int64_t value;
+    std::memcpy(&value, data_ + header_->indexOffset + i * sizeof(int64_t), sizeof(value));
+    return value;
+}
+
+cv::Mat FeatureStoreReader::matrix() const {
+    if (size() == 0) {
+        return cv::Mat();
+    }
+    uint8_t* records = const_cast<uint8_t*>(data_ + header_->headerSize);
+    switch (valueType()) {
+    case HOGValueType::FLOAT16:
+        return cv::Mat(static_cast<int>(size()), static_cast<int>(vectorLength()), CV_16F, records, recordSize_);
+    case HOGValueType::UINT8:
+        return cv::Mat(static_cast<int>(size()), static_cast<int>(vectorLength()), CV_8U,
+                       records + vectorLength() / groupLength_ * sizeof(float), recordSize_);
+    default:
+        return cv::Mat(static_cast<int>(size()), static_cast<int>(vectorLength()), CV_32F, records, recordSize_);
+    }
+}
+
+cv::Mat FeatureStoreReader::scales() const {
+    if (size() == 0 || valueType() != HOGValueType::UINT8) {
+        return cv::Mat();
+    }
+    return cv::Mat(static_cast<int>(size()), static_cast<int>(vectorLength() / groupLength_), CV_32F,
+                   const_cast<uint8_t*>(data_ + header_->headerSize), recordSize_);
+}
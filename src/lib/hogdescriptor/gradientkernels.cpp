@@ -0,0 +1,210 @@
+#include "gradientkernels.hpp"
+#include <opencv2/core.hpp>
+#include <algorithm>
+#include <array>
+#include <cfloat>
+#include <cmath>
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define HOG_X86_DISPATCH 1
+#include <immintrin.h>
+#else
+#define HOG_X86_DISPATCH 0
+#endif
+
+namespace hogkernels {
+
+namespace {
+
+// Polynomial coefficients of cv::fastAtan2, already scaled to degrees
+const float atanP1 = 0.9997878412794807f * static_cast<float>(180 / CV_PI);
+const float atanP3 = -0.3258083974640975f * static_cast<float>(180 / CV_PI);
+const float atanP5 = 0.1555786518463281f * static_cast<float>(180 / CV_PI);
+const float atanP7 = -0.04432655554792128f * static_cast<float>(180 / CV_PI);
+const float atanEps = static_cast<float>(DBL_EPSILON);
+
+// Orientation in degrees [0, 360), same operations as the vector kernels below
+inline float fastAtan2Deg(float y, float x) {
+    float ax = std::abs(x), ay = std::abs(y);
+    float c = std::min(ax, ay) / (std::max(ax, ay) + atanEps);
+    float c2 = c * c;
+    float a = (((atanP7 * c2 + atanP5) * c2 + atanP3) * c2 + atanP1) * c;
+    if (ax < ay) a = 90.f - a;
+    if (x < 0) a = 180.f - a;
+    if (y < 0) a = 360.f - a;
+    return a;
+}
+
+} // namespace
+
+void gradientRowScalar(const float* above, const float* row, const float* below, int n,
+                       const BinningParams& params, float* magnitude, int* bin) {
+    const int lastBin = params.binNumber - 1;
+    for (int x = 0; x < n; ++x) {
+        float gx = row[x + 2] - row[x];
+        float gy = below[x + 1] - above[x + 1];
+        magnitude[x] = std::sqrt(gx * gx + gy * gy);
+        float angle = fastAtan2Deg(gy, gx);
+        if (!params.signedGradient && angle >= 180.f) {
+            angle -= 180.f;
+        }
+        bin[x] = std::min(static_cast<int>(angle / params.binWidth), lastBin);
+    }
+}
+
+#if HOG_X86_DISPATCH
+
+namespace {
+
+// The orientation fold is resolved at compile time, one instance per gradient type
+template <bool Signed>
+__attribute__((target("sse4.1")))
+void gradientRowSSE41(const float* above, const float* row, const float* below, int n,
+                      const BinningParams& params, float* magnitude, int* bin) {
+    const __m128 signMask = _mm_set1_ps(-0.0f);
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 p1 = _mm_set1_ps(atanP1), p3 = _mm_set1_ps(atanP3);
+    const __m128 p5 = _mm_set1_ps(atanP5), p7 = _mm_set1_ps(atanP7);
+    const __m128 eps = _mm_set1_ps(atanEps);
+    const __m128 d90 = _mm_set1_ps(90.f), d180 = _mm_set1_ps(180.f), d360 = _mm_set1_ps(360.f);
+    const __m128 binWidth = _mm_set1_ps(params.binWidth);
+    const __m128i lastBin = _mm_set1_epi32(params.binNumber - 1);
+
+    int x = 0;
+    for (; x + 4 <= n; x += 4) {
+        __m128 gx = _mm_sub_ps(_mm_loadu_ps(row + x + 2), _mm_loadu_ps(row + x));
+        __m128 gy = _mm_sub_ps(_mm_loadu_ps(below + x + 1), _mm_loadu_ps(above + x + 1));
+        _mm_storeu_ps(magnitude + x, _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(gx, gx), _mm_mul_ps(gy, gy))));
+
+        __m128 ax = _mm_andnot_ps(signMask, gx), ay = _mm_andnot_ps(signMask, gy);
+        __m128 c = _mm_div_ps(_mm_min_ps(ax, ay), _mm_add_ps(_mm_max_ps(ax, ay), eps));
+        __m128 c2 = _mm_mul_ps(c, c);
+        __m128 a = _mm_add_ps(_mm_mul_ps(p7, c2), p5);
+        a = _mm_add_ps(_mm_mul_ps(a, c2), p3);
+        a = _mm_add_ps(_mm_mul_ps(a, c2), p1);
+        a = _mm_mul_ps(a, c);
+        a = _mm_blendv_ps(a, _mm_sub_ps(d90, a), _mm_cmplt_ps(ax, ay));
+        a = _mm_blendv_ps(a, _mm_sub_ps(d180, a), _mm_cmplt_ps(gx, zero));
+        a = _mm_blendv_ps(a, _mm_sub_ps(d360, a), _mm_cmplt_ps(gy, zero));
+        if constexpr (!Signed) {
+            a = _mm_sub_ps(a, _mm_and_ps(_mm_cmpge_ps(a, d180), d180));
+        }
+        __m128i b = _mm_cvttps_epi32(_mm_div_ps(a, binWidth));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(bin + x), _mm_min_epi32(b, lastBin));
+    }
+    if (x < n) {
+        gradientRowScalar(above + x, row + x, below + x, n - x, params, magnitude + x, bin + x);
+    }
+}
+
+template <bool Signed>
+__attribute__((target("avx2")))
+void gradientRowAVX2(const float* above, const float* row, const float* below, int n,
+                     const BinningParams& params, float* magnitude, int* bin) {
+    const __m256 signMask = _mm256_set1_ps(-0.0f);
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 p1 = _mm256_set1_ps(atanP1), p3 = _mm256_set1_ps(atanP3);
+    const __m256 p5 = _mm256_set1_ps(atanP5), p7 = _mm256_set1_ps(atanP7);
+    const __m256 eps = _mm256_set1_ps(atanEps);
+    const __m256 d90 = _mm256_set1_ps(90.f), d180 = _mm256_set1_ps(180.f), d360 = _mm256_set1_ps(360.f);
+    const __m256 binWidth = _mm256_set1_ps(params.binWidth);
+    const __m256i lastBin = _mm256_set1_epi32(params.binNumber - 1);
+
+    int x = 0;
+    for (; x + 8 <= n; x += 8) {
+        __m256 gx = _mm256_sub_ps(_mm256_loadu_ps(row + x + 2), _mm256_loadu_ps(row + x));
+        __m256 gy = _mm256_sub_ps(_mm256_loadu_ps(below + x + 1), _mm256_loadu_ps(above + x + 1));
+        _mm256_storeu_ps(magnitude + x, _mm256_sqrt_ps(_mm256_add_ps(_mm256_mul_ps(gx, gx), _mm256_mul_ps(gy, gy))));
+
+        __m256 ax = _mm256_andnot_ps(signMask, gx), ay = _mm256_andnot_ps(signMask, gy);
+        __m256 c = _mm256_div_ps(_mm256_min_ps(ax, ay), _mm256_add_ps(_mm256_max_ps(ax, ay), eps));
+        __m256 c2 = _mm256_mul_ps(c, c);
+        __m256 a = _mm256_add_ps(_mm256_mul_ps(p7, c2), p5);
+        a = _mm256_add_ps(_mm256_mul_ps(a, c2), p3);
+        a = _mm256_add_ps(_mm256_mul_ps(a, c2), p1);
+        a = _mm256_mul_ps(a, c);
+        a = _mm256_blendv_ps(a, _mm256_sub_ps(d90, a), _mm256_cmp_ps(ax, ay, _CMP_LT_OQ));
+        a = _mm256_blendv_ps(a, _mm256_sub_ps(d180, a), _mm256_cmp_ps(gx, zero, _CMP_LT_OQ));
+        a = _mm256_blendv_ps(a, _mm256_sub_ps(d360, a), _mm256_cmp_ps(gy, zero, _CMP_LT_OQ));
+        if constexpr (!Signed) {
+            a = _mm256_sub_ps(a, _mm256_and_ps(_mm256_cmp_ps(a, d180, _CMP_GE_OQ), d180));
+        }
+        __m256i b = _mm256_cvttps_epi32(_mm256_div_ps(a, binWidth));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(bin + x), _mm256_min_epi32(b, lastBin));
+    }
+    if (x < n) {
+        gradientRowSSE41<Signed>(above + x, row + x, below + x, n - x, params, magnitude + x, bin + x);
+    }
+}
+
+} // namespace
+
+#endif
+
+int orientationBin(float gx, float gy, const BinningParams& params) {
+    float angle = fastAtan2Deg(gy, gx);
+    if (!params.signedGradient && angle >= 180.f) {
+        angle -= 180.f;
+    }
+    return std::min(static_cast<int>(angle / params.binWidth), params.binNumber - 1);
+}
+
+std::vector<uint8_t> makeBinLookup(const BinningParams& params) {
+    std::vector<uint8_t> lookup(FIXED_GRADIENT_RANGE * FIXED_GRADIENT_RANGE);
+    const float scale = static_cast<float>(1 / 255.0);
+    for (int gy = -255; gy <= 255; ++gy) {
+        for (int gx = -255; gx <= 255; ++gx) {
+            lookup[(gy + 255) * FIXED_GRADIENT_RANGE + gx + 255] =
+                static_cast<uint8_t>(orientationBin(gx * scale, gy * scale, params));
+        }
+    }
+    return lookup;
+}
+
+namespace {
+
+// Fixed-point magnitude indexed by |gy| * 256 + |gx|, max 64 * 255 * sqrt(2) fits 16 bits
+const std::vector<uint16_t>& magnitudeLookup() {
+    static const std::vector<uint16_t> lookup = [] {
+        std::vector<uint16_t> table(256 * 256);
+        for (int gy = 0; gy < 256; ++gy) {
+            for (int gx = 0; gx < 256; ++gx) {
+                table[gy * 256 + gx] = static_cast<uint16_t>(
+                    std::lround(std::sqrt(static_cast<double>(gx * gx + gy * gy)) * (1 << FIXED_MAGNITUDE_SHIFT)));
+            }
+        }
+        return table;
+    }();
+    return lookup;
+}
+
+} // namespace
+
+void gradientRowFixed(const int16_t* above, const int16_t* row, const int16_t* below, int n,
+                      const uint8_t* binLookup, uint16_t* magnitude, uint8_t* bin) {
+    const uint16_t* magnitudes = magnitudeLookup().data();
+    for (int x = 0; x < n; ++x) {
+        int gx = row[x + 2] - row[x];
+        int gy = below[x + 1] - above[x + 1];
+        magnitude[x] = magnitudes[std::abs(gy) * 256 + std::abs(gx)];
+        bin[x] = binLookup[(gy + 255) * FIXED_GRADIENT_RANGE + gx + 255];
+    }
+}
+
+GradientRowFn gradientRow(bool signedGradient) {
+    // Unsigned and signed kernels of the best instruction set
+    static const std::array<GradientRowFn, 2> kernels = []() -> std::array<GradientRowFn, 2> {
+#if HOG_X86_DISPATCH
+        if (cv::checkHardwareSupport(CV_CPU_AVX2)) {
+            return {gradientRowAVX2<false>, gradientRowAVX2<true>};
+        }
+        if (cv::checkHardwareSupport(CV_CPU_SSE4_1)) {
+            return {gradientRowSSE41<false>, gradientRowSSE41<true>};
+        }
+#endif
+        return {gradientRowScalar, gradientRowScalar};
+    }();
+    return kernels[signedGradient];
+}
+
+} // namespace hogkernels
@@ -0,0 +1,90 @@
+#ifndef HOGDESCRIPTOR_GRADIENTKERNELS_H
+#define HOGDESCRIPTOR_GRADIENTKERNELS_H
+
+#include <cstdint>
+#include <vector>
+
+/**
+ * @brief Fused gradient, magnitude and orientation binning kernels with runtime SIMD dispatch
+ */
+namespace hogkernels {
+
+/**
+ * @brief Parameters of the orientation binning
+ */
+struct BinningParams {
+    float binWidth; //!< Width of the bins in degrees
+    int binNumber; //!< Number of the bins in the histogram
+    bool signedGradient; //!< True for 360 degree spread, false for 180
+};
+
+/**
+ * @brief Kernel computing the gradient magnitude and orientation bin of a row of pixels
+ *
+ * Gradients are central differences [-1, 0, 1], orientations follow cv::fastAtan2.
+ * Every input row holds n + 2 pixels: the left neighbour, the n pixels of the range and the right neighbour.
+ *
+ * @param above Row above the range
+ * @param row Row of the range
+ * @param below Row below the range
+ * @param n Number of pixels in the range
+ * @param params Binning parameters
+ * @param magnitude Output gradient magnitude of each pixel
+ * @param bin Output histogram bin of each pixel
+ */
+using GradientRowFn = void (*)(const float* above, const float* row, const float* below, int n,
+                               const BinningParams& params, float* magnitude, int* bin);
+
+/**
+ * @brief Best kernel for the current CPU (AVX2, SSE4.1 or scalar), selected on the first call
+ * 
+ * @param signedGradient Gradient type the kernel is specialized for, must match BinningParams::signedGradient
+ */
+GradientRowFn gradientRow(bool signedGradient);
+
+/**
+ * @brief Portable kernel, every SIMD kernel produces bit-identical results
+ */
+void gradientRowScalar(const float* above, const float* row, const float* below, int n,
+                       const BinningParams& params, float* magnitude, int* bin);
+
+/**
+ * @brief Orientation bin of one gradient, same result as the kernels above
+ * 
+ * @param gx Horizontal gradient
+ * @param gy Vertical gradient
+ * @param params Binning parameters
+ */
+int orientationBin(float gx, float gy, const BinningParams& params);
+
+static const int FIXED_MAGNITUDE_SHIFT = 6; //!< Fixed-point magnitudes are in 1/64 of a gray level
+static const int FIXED_GRADIENT_RANGE = 511; //!< Number of distinct 8-bit central differences [-255, 255]
+
+/**
+ * @brief Orientation bin lookup table of the 8-bit central differences
+ * 
+ * @param params Binning parameters
+ * @return Table indexed by (gy + 255) * 511 + (gx + 255)
+ */
+std::vector<uint8_t> makeBinLookup(const BinningParams& params);
+
+/**
+ * @brief Integer kernel for 8-bit images: fixed-point magnitude and table lookup orientation bin
+ *
+ * Rows hold n + 2 gray levels like the float kernels. Magnitudes are round(64 * sqrt(gx^2 + gy^2))
+ * for gx, gy in gray levels, so every pixel is off by at most 1/128 of a gray level.
+ *
+ * @param above Row above the range
+ * @param row Row of the range
+ * @param below Row below the range
+ * @param n Number of pixels in the range
+ * @param binLookup Table made by makeBinLookup
+ * @param magnitude Output fixed-point gradient magnitude of each pixel
+ * @param bin Output histogram bin of each pixel
+ */
+void gradientRowFixed(const int16_t* above, const int16_t* row, const int16_t* below, int n,
+                      const uint8_t* binLookup, uint16_t* magnitude, uint8_t* bin);
+
+} // namespace hogkernels
+
+#endif //HOGDESCRIPTOR_GRADIENTKERNELS_H
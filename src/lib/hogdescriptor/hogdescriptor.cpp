@@ -1,12 +1,178 @@
 #include "include/hogdescriptor/hogdescriptor.hpp"
+#include "include/hogdescriptor/threadpool.hpp"
+#include "include/hogdescriptor/featurecache.hpp"
+#include "gradientkernels.hpp"
+#include "cellkernels.hpp"
 #include <iostream>
 #include <fstream>
 #include <filesystem>
-#include <fstream>
+#include <utility>
+#include <cstring>
+#include <optional>
+#include <atomic>
+#include <mutex>
+#include <limits>
 
 
 namespace fs = std::filesystem;
 
+namespace {
+
+// Converts image columns [x0 - 1, x0 + n] of the first channel to floats, mirroring at the borders
+using RowLoader = void (*)(const cv::Mat& image, int y, int x0, int n, float* dst);
+
+// Scale of the pixel values to [0, 1]
+template <typename T> constexpr float pixelScale() { return 1.0f; }
+template <> constexpr float pixelScale<uchar>() { return static_cast<float>(1 / 255.0); }
+template <> constexpr float pixelScale<ushort>() { return static_cast<float>(1 / 65535.0); }
+
+template <typename T>
+void loadRow(const cv::Mat& image, int y, int x0, int n, float* dst){
+    const T* row = image.ptr<T>(y);
+    const int channels = image.channels();
+    const float scale = pixelScale<T>();
+    const int left = x0 > 0 ? x0 - 1 : 1;
+    const int right = x0 + n < image.cols ? x0 + n : image.cols - 2;
+
+    dst[0] = static_cast<float>(row[left * channels]) * scale;
+    for (int x = 0; x < n; ++x) {
+        dst[x + 1] = static_cast<float>(row[(x0 + x) * channels]) * scale;
+    }
+    dst[n + 1] = static_cast<float>(row[right * channels]) * scale;
+}
+
+// Integer version of loadRow for 8-bit images, values stay in gray levels
+void loadRowFixed(const cv::Mat& image, int y, int x0, int n, int16_t* dst){
+    const uchar* row = image.ptr<uchar>(y);
+    const int channels = image.channels();
+    const int left = x0 > 0 ? x0 - 1 : 1;
+    const int right = x0 + n < image.cols ? x0 + n : image.cols - 2;
+
+    dst[0] = row[left * channels];
+    for (int x = 0; x < n; ++x) {
+        dst[x + 1] = row[(x0 + x) * channels];
+    }
+    dst[n + 1] = row[right * channels];
+}
+
+RowLoader rowLoader(int depth){
+    switch (depth) {
+        case CV_8U: return loadRow<uchar>;
+        case CV_16U: return loadRow<ushort>;
+        case CV_32F: return loadRow<float>;
+        default: return nullptr;
+    }
+}
+
+// Image the fused kernels can read directly, other depths are converted once into the given buffer
+cv::Mat sourceView(const cv::Mat& image, cv::Mat& converted){
+    if (rowLoader(image.depth())) {
+        return image;
+    }
+    image.convertTo(converted, CV_32F);
+    return converted;
+}
+
+// True if all the channels of every pixel are equal, the row loop is branchless so it vectorizes
+template <typename T>
+bool isGrayscale(const cv::Mat& image){
+    const int channels = image.channels();
+    const int length = image.cols * channels;
+    for (int y = 0; y < image.rows; ++y) {
+        const T* row = image.ptr<T>(y);
+        bool different = false;
+        for (int x = 0; x < length; x += channels) {
+            for (int c = 1; c < channels; ++c) {
+                different |= row[x] != row[x + c];
+            }
+        }
+        if (different) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Expects one of the depths of rowLoader
+bool isGrayscale(const cv::Mat& image){
+    if (image.channels() == 1) {
+        return true;
+    }
+    switch (image.depth()) {
+        case CV_8U: return isGrayscale<uchar>(image);
+        case CV_16U: return isGrayscale<ushort>(image);
+        default: return isGrayscale<float>(image);
+    }
+}
+
+// Row index mirrored at the image border (BORDER_REFLECT_101, as cv::Sobel)
+int reflectRow(int y, int rows){
+    return y < 0 ? 1 : (y >= rows ? rows - 2 : y);
+}
+
+// Adds to a stats counter, nothing is left of it when instrumentation is compiled out
+inline void tally(uint64_t& counter, uint64_t value){
+    if constexpr (HOGStats::enabled) {
+        counter += value;
+    }
+}
+
+// Energy of a block as the sum of the energies of its cells in block order
+inline float blockEnergy(const float* cellEnergy, size_t rowStride, int cellsPerBlock){
+    float energy = 0.0f;
+    for (int i = 0; i < cellsPerBlock; ++i) {
+        for (int j = 0; j < cellsPerBlock; ++j) {
+            energy += cellEnergy[i * rowStride + j];
+        }
+    }
+    return energy;
+}
+
+inline uint64_t matBytes(const cv::Mat& mat){
+    return static_cast<uint64_t>(mat.total()) * mat.elemSize();
+}
+
+// Truncation and norm offset of the compact layout, as in the deformable part models
+constexpr float COMPACT_CLIP = 0.2f;
+constexpr float COMPACT_EPS = 1e-4f;
+
+// Relative margin of the cascade bounds over the float rounding of the normalization and the dot products
+constexpr double CASCADE_SLACK = 1e-4;
+
+// Largest dot product of the weights with a block normalized by the scheme, all normalized values are
+// non-negative, L2 schemes give |block|_2 <= 1, L2_CLIPPED values <= 0.5 and L1 |block|_1 <= 1
+double blockBound(const float* weights, size_t length, HOGDescriptor::NormType normType){
+    double positive = 0.0, squares = 0.0, largest = 0.0;
+    for (size_t i = 0; i < length; ++i) {
+        double weight = std::max(weights[i], 0.0f);
+        positive += weight;
+        squares += weight * weight;
+        largest = std::max(largest, weight);
+    }
+    switch (normType) {
+        case HOGDescriptor::NormType::L1: return largest;
+        case HOGDescriptor::NormType::L2_CLIPPED: return std::min(std::sqrt(squares), 0.5 * positive);
+        default: return std::sqrt(squares);
+    }
+}
+
+// Dot product in eight lanes, so it vectorizes without reassociation
+inline float dot(const float* a, const float* b, size_t length){
+    float lanes[8] = {};
+    size_t i = 0;
+    for (; i + 8 <= length; i += 8) {
+        for (size_t lane = 0; lane < 8; ++lane) {
+            lanes[lane] += a[i + lane] * b[i + lane];
+        }
+    }
+    for (size_t lane = 0; lane < 8 && i + lane < length; ++lane) {
+        lanes[lane] += a[i + lane] * b[i + lane];
+    }
+    return ((lanes[0] + lanes[4]) + (lanes[1] + lanes[5])) + ((lanes[2] + lanes[6]) + (lanes[3] + lanes[7]));
+}
+
+} // namespace
+
 // Parameters check
 void check_ctor_params(size_t blockSize, size_t cellSize, size_t stride, size_t binNumber, size_t gradType){
     if (blockSize < 2){
@@ -32,16 +198,19 @@ void check_ctor_params(size_t blockSize, size_t cellSize, size_t stride, size_t
 HOGDescriptor::HOGDescriptor()
     : blockSize_(16), cellSize_(8), stride_(8), binNumber_(9), gradType_(GRADIENT_UNSIGNED), 
       binWidth_(GRADIENT_UNSIGNED / 9){
+        kernels_ = hogkernels::selectKernels(cellSize_, binNumber_, blockSize_ / cellSize_, false, static_cast<int>(normType_));
     }
 
 HOGDescriptor::HOGDescriptor(const size_t blockSize, const size_t cellSize, 
-        const size_t stride, const size_t binNumber, const size_t gradType)
+        const size_t stride, const size_t binNumber, const size_t gradType, const NormType normType)
         : blockSize_(blockSize), cellSize_(cellSize),
     stride_(stride),
     binNumber_(binNumber),
     gradType_(gradType),
+    normType_(normType),
     binWidth_(gradType / binNumber){
         check_ctor_params(blockSize, cellSize, stride, binNumber, gradType);
+        kernels_ = hogkernels::selectKernels(cellSize_, binNumber_, blockSize_ / cellSize_, gradType_ == GRADIENT_SIGNED, static_cast<int>(normType_));
         }
 
 HOGDescriptor::HOGDescriptor(const size_t blockSize, const size_t cellSize)
@@ -51,12 +220,221 @@ HOGDescriptor::HOGDescriptor(const size_t blockSize, const size_t cellSize)
     gradType_(GRADIENT_UNSIGNED),
     binWidth_(GRADIENT_UNSIGNED / 9){
         check_ctor_params(blockSize, cellSize,  stride_, binNumber_, gradType_);
+        kernels_ = hogkernels::selectKernels(cellSize_, binNumber_, blockSize_ / cellSize_, false, static_cast<int>(normType_));
         }
 
 HOGDescriptor::~HOGDescriptor() {}
 
-void HOGDescriptor::computeHOG(cv::Mat& image){
-    
+template <typename Visitor>
+void HOGDescriptor::forEachBuffer(Visitor visit) const {
+    visit(workspace_.cellHistograms.capacity() * sizeof(float));
+    visit(workspace_.integralHistogram.capacity() * sizeof(double));
+    visit(workspace_.featureVector.capacity() * sizeof(float));
+    visit(workspace_.dirtyCells.capacity());
+    visit(workspace_.cellEnergy.capacity() * sizeof(float));
+    visit(workspace_.blockNorms.capacity() * sizeof(float));
+    for (const cv::Mat* mat : {&workspace_.converted, &workspace_.gray, &workspace_.gradientX, &workspace_.gradientY,
+                               &workspace_.previousFrame, &workspace_.source, &imageMagnitude_, &imageOrientation_}) {
+        visit(matBytes(*mat));
+    }
+    for (const HOGWorkspace::RowBuffers& band : workspace_.bands) {
+        visit(band.rows.capacity() * sizeof(float));
+        visit(band.magnitude.capacity() * sizeof(float));
+        visit(band.bin.capacity() * sizeof(int));
+        visit(band.fixedRows.capacity() * sizeof(int16_t));
+        visit(band.fixedMagnitude.capacity() * sizeof(uint16_t));
+        visit(band.fixedBin.capacity());
+        visit(band.accumulator.capacity() * sizeof(uint32_t));
+        visit(band.rowSum.capacity() * sizeof(double));
+    }
+}
+
+// Records one public call, calls nested in it (e.g. updateHOG falling back to computeHOG) add to the outer one
+class HOGDescriptor::CallScope {
+public:
+    CallScope(HOGDescriptor& hog, const char* call) : hog_(hog) {
+        if constexpr (HOGStats::enabled) {
+            if (hog_.callDepth_++ > 0) {
+                return;
+            }
+            hog_.stats_ = HOGStats{};
+            hog_.stats_.call = call;
+            hog_.bufferSizes_.clear();
+            hog_.forEachBuffer([this](size_t bytes) { hog_.bufferSizes_.push_back(bytes); });
+            start_ = std::chrono::steady_clock::now();
+        }
+    }
+
+    ~CallScope() {
+        if constexpr (HOGStats::enabled) {
+            if (--hog_.callDepth_ > 0) {
+                return;
+            }
+            HOGStats& stats = hog_.stats_;
+            stats.totalMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start_).count();
+
+            // A buffer that grew was allocated again, a new band brings new buffers
+            size_t index = 0;
+            hog_.forEachBuffer([&](size_t bytes) {
+                size_t previous = index < hog_.bufferSizes_.size() ? hog_.bufferSizes_[index] : 0;
+                if (bytes > previous) {
+                    stats.allocations++;
+                    stats.allocatedBytes += bytes - previous;
+                }
+                index++;
+            });
+            if (hog_.statsCallback_) {
+                hog_.statsCallback_(stats);
+            }
+        }
+    }
+
+    CallScope(const CallScope&) = delete;
+    CallScope& operator=(const CallScope&) = delete;
+
+private:
+    [[maybe_unused]] HOGDescriptor& hog_;
+    [[maybe_unused]] std::chrono::steady_clock::time_point start_;
+};
+
+// Times a stage, the stage it interrupts is paused until the scope ends
+class HOGDescriptor::StageScope {
+public:
+    StageScope(HOGDescriptor& hog, HOGStats::Stage stage) : hog_(hog) {
+        if constexpr (HOGStats::enabled) {
+            auto now = std::chrono::steady_clock::now();
+            previous_ = hog_.activeStage_;
+            if (previous_ >= 0) {
+                hog_.stats_.stageMs[previous_] += std::chrono::duration<double, std::milli>(now - hog_.stageStart_).count();
+            }
+            hog_.activeStage_ = stage;
+            hog_.stageStart_ = now;
+        }
+    }
+
+    ~StageScope() {
+        if constexpr (HOGStats::enabled) {
+            auto now = std::chrono::steady_clock::now();
+            hog_.stats_.stageMs[hog_.activeStage_] += std::chrono::duration<double, std::milli>(now - hog_.stageStart_).count();
+            hog_.activeStage_ = previous_;
+            hog_.stageStart_ = now;
+        }
+    }
+
+    StageScope(const StageScope&) = delete;
+    StageScope& operator=(const StageScope&) = delete;
+
+private:
+    [[maybe_unused]] HOGDescriptor& hog_;
+    [[maybe_unused]] int previous_ = -1;
+};
+
+void HOGDescriptor::setStatsCallback(HOGStatsCallback callback){
+    statsCallback_ = std::move(callback);
+}
+
+const HOGStats& HOGDescriptor::getStats() const {
+    return stats_;
+}
+
+void HOGDescriptor::computeHOG(const cv::Mat& image){
+    CallScope call(*this, "computeHOG");
+    setSourceImage(image);
+    frameKept_ = false;
+
+    // Cached results of the same pixels and settings replace the whole computation
+    uint64_t key = 0;
+    if (featureCache_) {
+        StageScope stage(*this, HOGStats::VALIDATION);
+        key = cacheKey(image);
+        tally(stats_.bytesRead, matBytes(image));
+        if (featureCache_->load(key, workspace_.cellHistograms, workspace_.featureVector)) {
+            tally(stats_.bytesRead, (workspace_.cellHistograms.size() + workspace_.featureVector.size()) * sizeof(float));
+            // The energies of updateHOG belong to the cells
+            if (featureLayout_ == FeatureLayout::BLOCKS && stride_ % cellSize_ == 0) {
+                computeCellEnergy(workspace_.cellHistograms);
+            }
+            gradientFlag_ = false;
+            integralFlag_ = false;
+            keepSourceImage();
+            hogFlag_ = true;
+            return;
+        }
+    }
+
+    // Compute the cell histograms
+    binSourceImage();
+
+    // Final HOG feature vector calculation
+    calculateHOGVector(workspace_.cellHistograms);
+
+    if (featureCache_) {
+        StageScope stage(*this, HOGStats::OUTPUT);
+        if (featureCache_->store(key, workspace_.cellHistograms, workspace_.featureVector)) {
+            tally(stats_.bytesWritten, (workspace_.cellHistograms.size() + workspace_.featureVector.size()) * sizeof(float));
+        }
+    }
+
+    keepSourceImage();
+    hogFlag_ = true;
+}
+
+std::future<std::span<const float>> HOGDescriptor::computeHOGAsync(cv::Mat image){
+    // std::function needs a copyable task, the promise is shared with it
+    auto promise = std::make_shared<std::promise<std::span<const float>>>();
+    std::future<std::span<const float>> result = promise->get_future();
+    ThreadPool::global().submit([this, promise, image = std::move(image)] {
+        try {
+            computeHOG(image);
+            promise->set_value(workspace_.featureVector);
+        } catch (...) {
+            promise->set_exception(std::current_exception());
+        }
+    });
+    return result;
+}
+
+HOGDescriptor::ComputeAwaitable HOGDescriptor::computeHOGAwaitable(cv::Mat image){
+    return ComputeAwaitable(*this, std::move(image));
+}
+
+void HOGDescriptor::ComputeAwaitable::await_suspend(std::coroutine_handle<> continuation){
+    ThreadPool::global().submit([this, continuation] {
+        try {
+            hog_.computeHOG(image_);
+        } catch (...) {
+            error_ = std::current_exception();
+        }
+        continuation.resume();
+    });
+}
+
+std::span<const float> HOGDescriptor::ComputeAwaitable::await_resume(){
+    if (error_) {
+        std::rethrow_exception(error_);
+    }
+    return hog_.workspace_.featureVector;
+}
+
+uint64_t HOGDescriptor::cacheKey(const cv::Mat& image) const {
+    const int64_t settings[] = {blockSize_, cellSize_, stride_, binNumber_, gradType_, static_cast<int64_t>(normType_),
+                                static_cast<int64_t>(featureLayout_), static_cast<int64_t>(histogramBackend_), integerPipeline_};
+    return FeatureCache::key(image, settings);
+}
+
+void HOGDescriptor::binSourceImage(){
+    // Strides that are not multiples of the cell size need blocks at exact pixel offsets
+    integralFlag_ = false;
+    if (histogramBackend_ == HistogramBackend::INTEGRAL || stride_ % cellSize_ != 0) {
+        computeIntegralHistograms(sourceImage_, workspace_.cellHistograms);
+    } else {
+        computeCellHistograms(sourceImage_, workspace_.cellHistograms); //18,144 values (cells_y*cells_x*binNumber_)
+    }
+}
+
+void HOGDescriptor::setSourceImage(const cv::Mat& image){
+    StageScope stage(*this, HOGStats::VALIDATION);
+
     // Check if the image is valid
     if (!image.data)
         throw std::runtime_error("Invalid image!");
@@ -66,117 +444,987 @@ void HOGDescriptor::computeHOG(cv::Mat& image){
         throw std::runtime_error("The image is empty!");
     }
 
+    // Gradients are binned on the fly, the full-image gradient matrices are only built on demand
+    sourceImage_ = sourceView(image, workspace_.converted);
+    gradientFlag_ = false;
+    if (sourceImage_.data != image.data) {
+        tally(stats_.bytesRead, matBytes(image));
+        tally(stats_.bytesWritten, matBytes(sourceImage_));
+    }
+
     // Check if the image is grayscale
-    for (int row = 0; row < image.rows; ++row) {
-        for (int col = 0; col < image.cols; ++col) {
-            const cv::Vec3b& pixel = image.at<cv::Vec3b>(row, col);
-            if (pixel[0] != pixel[1] || pixel[0] != pixel[2]) {
-                throw std::runtime_error("The image is not grayscale!");
+    if (grayscaleCheck_ && sourceImage_.channels() > 1) {
+        tally(stats_.bytesRead, matBytes(sourceImage_));
+        if (!isGrayscale(sourceImage_)) {
+            throw std::runtime_error("The image is not grayscale!");
+        }
+    }
+}
+
+void HOGDescriptor::keepSourceImage(const cv::Mat& kept){
+    // Converted images already live in the workspace
+    if (sourceImage_.data == workspace_.converted.data) {
+        return;
+    }
+    if (!kept.empty() && kept.size() == sourceImage_.size() && kept.type() == sourceImage_.type()) {
+        sourceImage_ = kept;
+        return;
+    }
+    StageScope stage(*this, HOGStats::OUTPUT);
+    sourceImage_.copyTo(workspace_.source);
+    tally(stats_.bytesRead, matBytes(sourceImage_));
+    tally(stats_.bytesWritten, matBytes(workspace_.source));
+    sourceImage_ = workspace_.source;
+}
+
+void HOGDescriptor::reserve(const cv::Size& imageSize, int type){
+    // A cache hit would skip the buffers to allocate
+    std::shared_ptr<FeatureCache> cache = std::exchange(featureCache_, nullptr);
+    computeHOG(cv::Mat::zeros(imageSize, type));
+    featureCache_ = std::move(cache);
+    sourceImage_.release();
+    hogFlag_ = false;
+}
+
+void HOGDescriptor::updateHOG(const cv::Mat& frame, std::span<const cv::Rect> dirtyRects){
+    // Only a cell grid result of the same frame geometry can be patched
+    bool patchable = hogFlag_ && !workspace_.cellHistograms.empty() && featureLayout_ == FeatureLayout::BLOCKS &&
+        histogramBackend_ == HistogramBackend::CELL_GRID && stride_ % cellSize_ == 0 &&
+        frame.size() == sourceImage_.size() && frame.type() == sourceImage_.type() &&
+        workspace_.cellHistograms.rows() == frame.rows / cellSize_ && workspace_.cellHistograms.cols() == frame.cols / cellSize_;
+    CallScope call(*this, "updateHOG");
+    if (!patchable) {
+        computeHOG(frame);
+    } else {
+        setSourceImage(frame);
+
+        // A pixel changes the central differences of its four neighbours too
+        const int cellsY = workspace_.cellHistograms.rows();
+        const int cellsX = workspace_.cellHistograms.cols();
+        const cv::Rect grid(0, 0, cellsX * cellSize_, cellsY * cellSize_);
+        workspace_.dirtyCells.assign(static_cast<size_t>(cellsY) * cellsX, 0);
+        for (const cv::Rect& rect : dirtyRects) {
+            cv::Rect reach = cv::Rect(rect.x - 1, rect.y - 1, rect.width + 2, rect.height + 2) & grid;
+            if (rect.empty() || reach.empty()) {
+                continue;
+            }
+            for (int y = reach.y / cellSize_; y <= (reach.y + reach.height - 1) / cellSize_; ++y) {
+                uint8_t* row = workspace_.dirtyCells.data() + static_cast<size_t>(y) * cellsX;
+                std::fill(row + reach.x / cellSize_, row + (reach.x + reach.width - 1) / cellSize_ + 1, 1);
             }
         }
+        updateDirtyCells();
     }
 
-    // Compute the gradient features
-    computeGradientFeatures(image);
+    // Keep the frame for the automatic differencing of the next one
+    StageScope stage(*this, HOGStats::VALIDATION);
+    frame.copyTo(workspace_.previousFrame);
+    tally(stats_.bytesRead, matBytes(frame));
+    tally(stats_.bytesWritten, matBytes(frame));
+    frameKept_ = true;
+    keepSourceImage(workspace_.previousFrame);
+}
 
-    // Compute the cell histograms
-    cellHistograms_ = computeCellHistograms(imageMagnitude_, imageOrientation_, cellHistograms_); //18,144 values (cells_y*cells_x*binNumber_)
+void HOGDescriptor::updateHOG(const cv::Mat& frame){
+    CallScope call(*this, "updateHOG");
+    const cv::Mat& previous = workspace_.previousFrame;
+    if (!frameKept_ || frame.size() != previous.size() || frame.type() != previous.type() || featureLayout_ != FeatureLayout::BLOCKS ||
+        histogramBackend_ != HistogramBackend::CELL_GRID || stride_ % cellSize_ != 0) {
+        computeHOG(frame);
+        StageScope stage(*this, HOGStats::VALIDATION);
+        frame.copyTo(workspace_.previousFrame);
+        tally(stats_.bytesRead, matBytes(frame));
+        tally(stats_.bytesWritten, matBytes(frame));
+        frameKept_ = true;
+        keepSourceImage(workspace_.previousFrame);
+        return;
+    }
+    setSourceImage(frame);
+    std::optional<StageScope> detection(std::in_place, *this, HOGStats::VALIDATION);
 
-    // Final HOG feature vector calculation
-    hogFeatureVector_ = calculateHOGVector(cellHistograms_);
+    // Compare the frames cell segment by cell segment, a changed pixel dirties the cells within one pixel of it
+    const int cellsY = workspace_.cellHistograms.rows();
+    const int cellsX = workspace_.cellHistograms.cols();
+    const size_t pixelSize = frame.elemSize();
+    const size_t segmentSize = cellSize_ * pixelSize;
+    const int lastY = std::min(frame.rows - 1, cellsY * cellSize_);
+    workspace_.dirtyCells.assign(static_cast<size_t>(cellsY) * cellsX, 0);
+    for (int y = 0; y <= lastY; ++y) {
+        const uchar* current = frame.ptr<uchar>(y);
+        const uchar* before = previous.ptr<uchar>(y);
+        const int firstCellY = std::max(0, y - 1) / cellSize_;
+        const int lastCellY = std::min(cellsY - 1, (y + 1) / cellSize_);
+        // The column after the grid still reaches the last cell of the row
+        const int segments = std::min(cellsX + 1, (frame.cols + cellSize_ - 1) / cellSize_);
+        for (int cx = 0; cx < segments; ++cx) {
+            size_t begin = cx * segmentSize;
+            size_t length = std::min(segmentSize, frame.cols * pixelSize - begin);
+            if (std::memcmp(current + begin, before + begin, length) == 0) {
+                continue;
+            }
+            // First and last changed pixel of the segment
+            int first = 0, last = static_cast<int>(length / pixelSize) - 1;
+            while (std::memcmp(current + begin + first * pixelSize, before + begin + first * pixelSize, pixelSize) == 0) {
+                first++;
+            }
+            while (std::memcmp(current + begin + last * pixelSize, before + begin + last * pixelSize, pixelSize) == 0) {
+                last--;
+            }
+            int firstCellX = std::max(0, cx * cellSize_ + first - 1) / cellSize_;
+            int lastCellX = std::min(cellsX - 1, (cx * cellSize_ + last + 1) / cellSize_);
+            for (int cy = firstCellY; cy <= lastCellY; ++cy) {
+                uint8_t* row = workspace_.dirtyCells.data() + static_cast<size_t>(cy) * cellsX;
+                std::fill(row + firstCellX, row + lastCellX + 1, 1);
+            }
+        }
+    }
+    tally(stats_.bytesRead, 2 * matBytes(frame));
+    detection.reset();
+    updateDirtyCells();
+
+    StageScope stage(*this, HOGStats::VALIDATION);
+    frame.copyTo(workspace_.previousFrame);
+    tally(stats_.bytesRead, matBytes(frame));
+    tally(stats_.bytesWritten, matBytes(frame));
+    keepSourceImage(workspace_.previousFrame);
+}
+
+void HOGDescriptor::updateDirtyCells(){
+    CellHistograms& cells = workspace_.cellHistograms;
+    const int cellsY = cells.rows();
+    const int cellsX = cells.cols();
+    const uint8_t* dirty = workspace_.dirtyCells.data();
+    if (workspace_.bands.empty()) {
+        workspace_.bands.resize(1);
+    }
+
+    // Rebin every run of dirty cells in a cell row, the sums come out as in a full pass
+    std::optional<StageScope> binning(std::in_place, *this, HOGStats::BINNING);
+    for (int y = 0; y < cellsY; ++y) {
+        const uint8_t* row = dirty + static_cast<size_t>(y) * cellsX;
+        for (int x = 0; x < cellsX; ) {
+            if (!row[x]) {
+                x++;
+                continue;
+            }
+            int end = x;
+            while (end < cellsX && row[end]) {
+                end++;
+            }
+            std::span<float> histograms = cells.row(y).subspan(static_cast<size_t>(x) * binNumber_, static_cast<size_t>(end - x) * binNumber_);
+            std::fill(histograms.begin(), histograms.end(), 0.0f);
+            binCells(sourceImage_, cv::Rect(x, y, end - x, 1), cells, workspace_.bands[0]);
+            kernels_->cellEnergy(histograms.data(), end - x, binNumber_, workspace_.cellEnergy.data() + static_cast<size_t>(y) * cellsX + x);
+            tally(stats_.cells, end - x);
+            tally(stats_.bytesRead, static_cast<uint64_t>(end - x) * cellSize_ * cellSize_ * sourceImage_.elemSize());
+            tally(stats_.bytesWritten, histograms.size_bytes());
+            x = end;
+        }
+    }
+    binning.reset();
+
+    // Normalize again the blocks holding a dirty cell
+    StageScope normalization(*this, HOGStats::NORMALIZATION);
+    const int numCellsInDirection = blockSize_ / cellSize_;
+    const int strideCells = stride_ / cellSize_;
+    const int blocksX = (cellsX * cellSize_ - blockSize_) / stride_ + 1;
+    const int blocksY = (cellsY * cellSize_ - blockSize_) / stride_ + 1;
+    const size_t blockLength = static_cast<size_t>(numCellsInDirection) * numCellsInDirection * binNumber_;
+    for (int by = 0; by < blocksY; ++by) {
+        for (int bx = 0; bx < blocksX; ++bx) {
+            bool changed = false;
+            for (int i = 0; i < numCellsInDirection && !changed; ++i) {
+                const uint8_t* row = dirty + static_cast<size_t>(by * strideCells + i) * cellsX + bx * strideCells;
+                changed = std::find(row, row + numCellsInDirection, 1) != row + numCellsInDirection;
+            }
+            if (changed) {
+                float* block = workspace_.featureVector.data() + (static_cast<size_t>(by) * blocksX + bx) * blockLength;
+                fillBlock(cells, by, bx, std::span<float>(block, blockLength));
+                tally(stats_.blocks, 1);
+                tally(stats_.bytesRead, blockLength * sizeof(float));
+                tally(stats_.bytesWritten, blockLength * sizeof(float));
+            }
+        }
+    }
+
+    gradientFlag_ = false;
+    integralFlag_ = false;
+    hogFlag_ = true;
+}
+
+cv::Mat HOGDescriptor::computeHOGBatch(std::span<const cv::Mat> images){
+    if (images.empty()) {
+        return cv::Mat();
+    }
+
+    // The output matrix is allocated once, so every image must give a vector of the same length
+    size_t descriptorSize = getDescriptorSize(images[0].size());
+    for (const cv::Mat& image : images) {
+        if (getDescriptorSize(image.size()) != descriptorSize) {
+            throw std::invalid_argument("HOGDescriptor: batch images must give feature vectors of the same length");
+        }
+    }
+
+    CallScope call(*this, "computeHOGBatch");
+    std::mutex statsMutex;
+    cv::Mat descriptors(static_cast<int>(images.size()), static_cast<int>(descriptorSize), CV_32F);
+    ThreadPool::global().parallelFor(0, static_cast<int>(images.size()), [&](int begin, int end) {
+        // One descriptor per task, its buffers are reused for every image of the chunk
+        HOGDescriptor hog = cloneSettings();
+        HOGStats taskStats;
+        for (int i = begin; i < end; ++i) {
+            hog.computeHOG(images[i]);
+            std::copy(hog.workspace_.featureVector.begin(), hog.workspace_.featureVector.end(), descriptors.ptr<float>(i));
+            taskStats.add(hog.stats_);
+        }
+        // The copies report through the call of this descriptor
+        if constexpr (HOGStats::enabled) {
+            std::lock_guard<std::mutex> lock(statsMutex);
+            stats_.add(taskStats);
+        }
+    });
+
+    return descriptors;
+}
+
+size_t HOGDescriptor::getDescriptorSize(const cv::Size& imageSize) const {
+    int imageWidth = imageSize.width / cellSize_ * cellSize_;
+    int imageHeight = imageSize.height / cellSize_ * cellSize_;
+    if (imageWidth < blockSize_ || imageHeight < blockSize_) {
+        return 0;
+    }
+    if (featureLayout_ == FeatureLayout::COMPACT) {
+        size_t cellsX = imageWidth / cellSize_;
+        size_t cellsY = imageHeight / cellSize_;
+        return cellsX < 3 || cellsY < 3 ? 0 : (cellsX - 2) * (cellsY - 2) * featureGroupLength();
+    }
+    size_t blocksX = (imageWidth - blockSize_) / stride_ + 1;
+    size_t blocksY = (imageHeight - blockSize_) / stride_ + 1;
+    size_t numCellsInDirection = blockSize_ / cellSize_;
+    return blocksX * blocksY * numCellsInDirection * numCellsInDirection * binNumber_;
+}
+
+HOGParameters HOGDescriptor::getParameters() const {
+    return {blockSize_, cellSize_, stride_, binNumber_, gradType_};
+}
+
+HOGDescriptor::NormType HOGDescriptor::getNormType() const {
+    return normType_;
+}
+
+HOGDescriptor HOGDescriptor::cloneSettings() const {
+    HOGDescriptor hog(blockSize_, cellSize_, stride_, binNumber_, gradType_, normType_);
+    hog.histogramBackend_ = histogramBackend_;
+    hog.integerPipeline_ = integerPipeline_;
+    hog.grayscaleCheck_ = grayscaleCheck_;
+    hog.binLookup_ = binLookup_;
+    hog.featureLayout_ = featureLayout_;
+    hog.featureCache_ = featureCache_;
+    return hog;
+}
+
+void HOGDescriptor::checkWindowSize(const cv::Size& windowSize) const {
+    if (featureLayout_ != FeatureLayout::BLOCKS){
+        throw std::invalid_argument("HOGDescriptor: windows require the block feature layout");
+    }
+    // Windows must consist of whole blocks of the image block grid
+    if (windowSize.width < blockSize_ || windowSize.height < blockSize_){
+        throw std::invalid_argument("HOGDescriptor: windowSize must be >= blockSize");
+    }
+    if ((windowSize.width - blockSize_) % stride_ != 0 || (windowSize.height - blockSize_) % stride_ != 0){
+        throw std::invalid_argument("HOGDescriptor: windowSize - blockSize must be multiple of stride");
+    }
+}
+
+void HOGDescriptor::checkWindowStride(const cv::Size& windowStride) const {
+    if (windowStride.width <= 0 || windowStride.height <= 0 ||
+        windowStride.width % stride_ != 0 || windowStride.height % stride_ != 0){
+        throw std::invalid_argument("HOGDescriptor: windowStride must be multiple of stride");
+    }
+}
+
+cv::Mat HOGDescriptor::computeWindows(const cv::Mat& image, const cv::Size& windowSize, const cv::Size& windowStride, std::vector<cv::Point>& locations){
+    checkWindowSize(windowSize);
+    checkWindowStride(windowStride);
+
+    CallScope call(*this, "computeWindows");
+    computeHOG(image);
+    StageScope stage(*this, HOGStats::OUTPUT);
+
+    // Block grid of the whole image, laid out row by row in workspace_.featureVector
+    int imageWidth = workspace_.cellHistograms.cols() * cellSize_;
+    int imageHeight = workspace_.cellHistograms.rows() * cellSize_;
+    int blocksX = (imageWidth - blockSize_) / stride_ + 1;
+    int numCellsInDirection = blockSize_ / cellSize_;
+    size_t blockLength = static_cast<size_t>(numCellsInDirection) * numCellsInDirection * binNumber_;
+
+    // Block grid of one window
+    int windowBlocksX = (windowSize.width - blockSize_) / stride_ + 1;
+    int windowBlocksY = (windowSize.height - blockSize_) / stride_ + 1;
+    size_t windowRowLength = windowBlocksX * blockLength;
+
+    locations.clear();
+    if (imageWidth < windowSize.width || imageHeight < windowSize.height) {
+        return cv::Mat();
+    }
+    int windowsX = (imageWidth - windowSize.width) / windowStride.width + 1;
+    int windowsY = (imageHeight - windowSize.height) / windowStride.height + 1;
+    locations.reserve(static_cast<size_t>(windowsX) * windowsY);
+
+    cv::Mat descriptors(windowsX * windowsY, static_cast<int>(windowRowLength * windowBlocksY), CV_32F);
+    for (int wy = 0; wy < windowsY; wy++) {
+        for (int wx = 0; wx < windowsX; wx++) {
+            cv::Point location(wx * windowStride.width, wy * windowStride.height);
+            int firstBlockX = location.x / stride_;
+            int firstBlockY = location.y / stride_;
+
+            // Each block row of the window is one contiguous run of the image vector
+            float* descriptor = descriptors.ptr<float>(static_cast<int>(locations.size()));
+            for (int by = 0; by < windowBlocksY; by++) {
+                const float* blocks = workspace_.featureVector.data() + ((firstBlockY + by) * blocksX + firstBlockX) * blockLength;
+                std::copy(blocks, blocks + windowRowLength, descriptor + by * windowRowLength);
+            }
+            locations.push_back(location);
+        }
+    }
+    tally(stats_.bytesRead, matBytes(descriptors));
+    tally(stats_.bytesWritten, matBytes(descriptors));
+
+    return descriptors;
+}
+
+std::vector<float> HOGDescriptor::scoreWindows(const cv::Mat& image, const LinearClassifier& classifier, const cv::Size& windowSize,
+                                               const cv::Size& windowStride, std::vector<cv::Point>& locations, std::optional<float> threshold){
+    checkWindowSize(windowSize);
+    checkWindowStride(windowStride);
+    const int numCellsInDirection = blockSize_ / cellSize_;
+    const size_t blockLength = static_cast<size_t>(numCellsInDirection) * numCellsInDirection * binNumber_;
+    const int windowBlocksX = (windowSize.width - blockSize_) / stride_ + 1;
+    const int windowBlocksY = (windowSize.height - blockSize_) / stride_ + 1;
+    const size_t windowBlocks = static_cast<size_t>(windowBlocksX) * windowBlocksY;
+    if (classifier.weights.size() != windowBlocks * blockLength){
+        throw std::invalid_argument("HOGDescriptor: classifier weights must have the length of the window descriptor");
+    }
+
+    CallScope call(*this, "scoreWindows");
+    setSourceImage(image);
+    frameKept_ = false;
+    hogFlag_ = false;
+    binSourceImage();
+
+    const CellHistograms& cells = workspace_.cellHistograms;
+    const int imageWidth = cells.cols() * cellSize_;
+    const int imageHeight = cells.rows() * cellSize_;
+    locations.clear();
+    if (imageWidth < windowSize.width || imageHeight < windowSize.height) {
+        return {};
+    }
+    const int windowsX = (imageWidth - windowSize.width) / windowStride.width + 1;
+    const int windowsY = (imageHeight - windowSize.height) / windowStride.height + 1;
+    locations.reserve(static_cast<size_t>(windowsX) * windowsY);
+    for (int wy = 0; wy < windowsY; wy++) {
+        for (int wx = 0; wx < windowsX; wx++) {
+            locations.emplace_back(wx * windowStride.width, wy * windowStride.height);
+        }
+    }
+
+    StageScope stage(*this, HOGStats::NORMALIZATION);
+    if (stride_ % cellSize_ == 0) {
+        computeCellEnergy(cells);
+    }
+
+    // Blocks of a window in scoring order, remaining[i] bounds what the blocks from the i-th on can still add
+    std::vector<size_t> order(windowBlocks);
+    std::iota(order.begin(), order.end(), 0);
+    std::vector<double> remaining(windowBlocks + 1, 0.0);
+    if (threshold) {
+        std::vector<double> bounds(windowBlocks);
+        for (size_t k = 0; k < windowBlocks; k++) {
+            bounds[k] = blockBound(classifier.weights.data() + k * blockLength, blockLength, normType_) * (1.0 + CASCADE_SLACK);
+        }
+        std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return bounds[a] > bounds[b]; });
+        for (size_t i = windowBlocks; i-- > 0; ) {
+            remaining[i] = remaining[i + 1] + bounds[order[i]];
+        }
+    }
+
+    // Block rows are normalized once into a ring of the block rows under one row of windows,
+    // a few hundred kilobytes that stay in cache while every window of the row reads them
+    const int windowStrideX = windowStride.width / stride_;
+    const int windowStrideY = windowStride.height / stride_;
+    const int bandBlocksX = (windowsX - 1) * windowStrideX + windowBlocksX;
+    const size_t bandRowLength = static_cast<size_t>(bandBlocksX) * blockLength;
+    std::vector<float> scores(locations.size());
+    std::atomic<uint64_t> normalizedBlocks{0}, scoredBlocks{0};
+    auto windowRows = [&](int rowBegin, int rowEnd) {
+        std::vector<float> band(static_cast<size_t>(windowBlocksY) * bandRowLength);
+        uint64_t normalizedCount = 0, scoredCount = 0;
+        int nextBlockY = rowBegin * windowStrideY;
+        for (int wy = rowBegin; wy < rowEnd; wy++) {
+            const int firstBlockY = wy * windowStrideY;
+            for (int by = std::max(nextBlockY, firstBlockY); by < firstBlockY + windowBlocksY; by++) {
+                float* block = band.data() + static_cast<size_t>(by % windowBlocksY) * bandRowLength;
+                for (int bx = 0; bx < bandBlocksX; bx++, block += blockLength) {
+                    fillBlock(cells, by, bx, std::span<float>(block, blockLength));
+                }
+                normalizedCount += bandBlocksX;
+            }
+            nextBlockY = firstBlockY + windowBlocksY;
+
+            for (int wx = 0; wx < windowsX; wx++) {
+                const int firstBlockX = wx * windowStrideX;
+                double score = classifier.bias;
+                size_t i = 0;
+                for (; i < windowBlocks; i++) {
+                    if (threshold && score + remaining[i] < *threshold) {
+                        break;
+                    }
+                    const int k = static_cast<int>(order[i]);
+                    const int by = firstBlockY + k / windowBlocksX;
+                    const int bx = firstBlockX + k % windowBlocksX;
+                    const float* block = band.data() + static_cast<size_t>(by % windowBlocksY) * bandRowLength + bx * blockLength;
+                    score += dot(block, classifier.weights.data() + k * blockLength, blockLength);
+                }
+                scoredCount += i;
+                scores[static_cast<size_t>(wy) * windowsX + wx] = i == windowBlocks ? static_cast<float>(score) : -std::numeric_limits<float>::infinity();
+            }
+        }
+        normalizedBlocks += normalizedCount;
+        scoredBlocks += scoredCount;
+    };
+
+    // Every row of windows is scored independently
+    size_t pixels = static_cast<size_t>(imageWidth) * imageHeight;
+    if (pixels < PARALLEL_MIN_PIXELS) {
+        windowRows(0, windowsY);
+    } else {
+        // Each task normalizes the block rows under its windows, long runs of rows share most of them
+        ThreadPool::global().parallelFor(0, windowsY, std::cref(windowRows), std::max(1, windowBlocksY / windowStrideY));
+    }
+    tally(stats_.blocks, normalizedBlocks.load());
+    tally(stats_.bytesRead, (normalizedBlocks.load() + 2 * scoredBlocks.load()) * blockLength * sizeof(float));
+    tally(stats_.bytesWritten, scores.size() * sizeof(float));
+
+    return scores;
+}
+
+cv::Mat HOGDescriptor::computeAt(const cv::Mat& image, std::span<const cv::Point> locations, const cv::Size& windowSize){
+    checkWindowSize(windowSize);
+    if (stride_ % cellSize_ != 0){
+        throw std::invalid_argument("HOGDescriptor: sparse extraction requires stride to be multiple of cellSize");
+    }
+
+    CallScope call(*this, "computeAt");
+    setSourceImage(image);
+    hogFlag_ = false;
+    frameKept_ = false;
+    integralFlag_ = false;
+    if (locations.empty()) {
+        return cv::Mat();
+    }
+
+    // Windows in cell units, each one must fit in the cell grid of the image
+    const int cellsY = sourceImage_.rows / cellSize_;
+    const int cellsX = sourceImage_.cols / cellSize_;
+    const int windowCellsX = windowSize.width / cellSize_;
+    const int windowCellsY = windowSize.height / cellSize_;
+    for (const cv::Point& location : locations) {
+        if (location.x < 0 || location.y < 0 ||
+            location.x / cellSize_ + windowCellsX > cellsX || location.y / cellSize_ + windowCellsY > cellsY) {
+            throw std::runtime_error("Invalid position!");
+        }
+    }
+
+    // Flag the cells covered by the windows, the histograms are zeroed only where they are binned
+    CellHistograms& cells = workspace_.cellHistograms;
+    cells.reshape(cellsY, cellsX, binNumber_);
+    workspace_.cellEnergy.resize(static_cast<size_t>(cellsY) * cellsX);
+    std::vector<uint8_t>& needed = workspace_.dirtyCells;
+    needed.assign(static_cast<size_t>(cellsY) * cellsX, 0);
+    size_t neededCount = 0;
+    for (const cv::Point& location : locations) {
+        for (int y = location.y / cellSize_; y < location.y / cellSize_ + windowCellsY; ++y) {
+            uint8_t* row = needed.data() + static_cast<size_t>(y) * cellsX + location.x / cellSize_;
+            neededCount += windowCellsX - std::count(row, row + windowCellsX, 1);
+            std::fill(row, row + windowCellsX, 1);
+        }
+    }
+
+    // Bin every run of flagged cells once, overlapping windows share the cells
+    {
+        StageScope stage(*this, HOGStats::BINNING);
+        auto binRows = [&](int rowBegin, int rowEnd, HOGWorkspace::RowBuffers& buffers) {
+            for (int y = rowBegin; y < rowEnd; ++y) {
+                const uint8_t* row = needed.data() + static_cast<size_t>(y) * cellsX;
+                for (int x = 0; x < cellsX; ) {
+                    if (!row[x]) {
+                        x++;
+                        continue;
+                    }
+                    int end = x;
+                    while (end < cellsX && row[end]) {
+                        end++;
+                    }
+                    std::span<float> histograms = cells.row(y).subspan(static_cast<size_t>(x) * binNumber_, static_cast<size_t>(end - x) * binNumber_);
+                    std::fill(histograms.begin(), histograms.end(), 0.0f);
+                    binCells(sourceImage_, cv::Rect(x, y, end - x, 1), cells, buffers);
+                    kernels_->cellEnergy(histograms.data(), end - x, binNumber_, workspace_.cellEnergy.data() + static_cast<size_t>(y) * cellsX + x);
+                    x = end;
+                }
+            }
+        };
+
+        std::vector<HOGWorkspace::RowBuffers>& bands = workspace_.bands;
+        ThreadPool& pool = ThreadPool::global();
+        if (neededCount * cellSize_ * cellSize_ < PARALLEL_MIN_PIXELS) {
+            if (bands.empty()) {
+                bands.resize(1);
+            }
+            binRows(0, cellsY, bands[0]);
+        } else {
+            // A few bands per thread, as the flagged cells may gather in some of them
+            int bandCount = std::min<int>(cellsY, 4 * std::max(1u, pool.size()));
+            int bandRows = (cellsY + bandCount - 1) / bandCount;
+            if (bands.size() < static_cast<size_t>(bandCount)) {
+                bands.resize(bandCount);
+            }
+            auto bandLoop = [&](int begin, int end) {
+                for (int band = begin; band < end; ++band) {
+                    binRows(band * bandRows, std::min(cellsY, (band + 1) * bandRows), bands[band]);
+                }
+            };
+            pool.parallelFor(0, bandCount, std::cref(bandLoop));
+        }
+        tally(stats_.cells, neededCount);
+        tally(stats_.bytesRead, neededCount * cellSize_ * cellSize_ * sourceImage_.elemSize());
+        tally(stats_.bytesWritten, neededCount * binNumber_ * sizeof(float));
+    }
+
+    // Gather and normalize the blocks of every window straight into its row
+    StageScope stage(*this, HOGStats::NORMALIZATION);
+    const int numCellsInDirection = blockSize_ / cellSize_;
+    const int strideCells = stride_ / cellSize_;
+    const int windowBlocksX = (windowSize.width - blockSize_) / stride_ + 1;
+    const int windowBlocksY = (windowSize.height - blockSize_) / stride_ + 1;
+    const size_t blockLength = static_cast<size_t>(numCellsInDirection) * numCellsInDirection * binNumber_;
+    const size_t rowStride = static_cast<size_t>(cellsX) * binNumber_;
+    cv::Mat descriptors(static_cast<int>(locations.size()), static_cast<int>(windowBlocksX * windowBlocksY * blockLength), CV_32F);
+    auto windowLoop = [&](int begin, int end) {
+        for (int i = begin; i < end; ++i) {
+            const int firstCellY = locations[i].y / cellSize_;
+            const int firstCellX = locations[i].x / cellSize_;
+            float* block = descriptors.ptr<float>(i);
+            for (int by = 0; by < windowBlocksY; ++by) {
+                for (int bx = 0; bx < windowBlocksX; ++bx) {
+                    const int cellY = firstCellY + by * strideCells;
+                    const int cellX = firstCellX + bx * strideCells;
+                    kernels_->copyBlock(std::as_const(cells)(cellY, cellX).data(), rowStride, numCellsInDirection, binNumber_, block);
+                    const float* energy = workspace_.cellEnergy.data() + static_cast<size_t>(cellY) * cellsX + cellX;
+                    normalizeBlockHistogram(std::span<float>(block, blockLength), blockEnergy(energy, cellsX, numCellsInDirection));
+                    block += blockLength;
+                }
+            }
+        }
+    };
+    if (locations.size() * windowSize.area() < PARALLEL_MIN_PIXELS) {
+        windowLoop(0, static_cast<int>(locations.size()));
+    } else {
+        ThreadPool::global().parallelFor(0, static_cast<int>(locations.size()), std::cref(windowLoop));
+    }
+    tally(stats_.blocks, locations.size() * windowBlocksX * windowBlocksY);
+    tally(stats_.bytesRead, matBytes(descriptors));
+    tally(stats_.bytesWritten, matBytes(descriptors));
+
+    return descriptors;
+}
+
+cv::Mat HOGDescriptor::computeAt(const cv::Mat& image, std::span<const cv::Rect> regions){
+    if (regions.empty()) {
+        return computeAt(image, std::span<const cv::Point>(), cv::Size(blockSize_, blockSize_));
+    }
+    std::vector<cv::Point> locations;
+    locations.reserve(regions.size());
+    for (const cv::Rect& region : regions) {
+        if (region.size() != regions[0].size()) {
+            throw std::invalid_argument("HOGDescriptor: regions must have the same size");
+        }
+        locations.push_back(region.tl());
+    }
+    return computeAt(image, locations, regions[0].size());
+}
 
+std::vector<HOGPyramidLevel> HOGDescriptor::computePyramid(const cv::Mat& image, int scalesPerOctave, double lambda){
+    if (scalesPerOctave < 1){
+        throw std::invalid_argument("HOGDescriptor: scalesPerOctave must be >= 1");
+    }
+    if (stride_ % cellSize_ != 0){
+        throw std::invalid_argument("HOGDescriptor: pyramid requires stride to be multiple of cellSize");
+    }
+
+    CallScope call(*this, "computePyramid");
+    setSourceImage(image);
+
+    // Scales whose cell grid still holds at least one block
+    std::vector<HOGPyramidLevel> levels;
+    for (int k = 0; ; k++) {
+        double scale = std::pow(2.0, -static_cast<double>(k) / scalesPerOctave);
+        int cellsY = cvRound(image.rows * scale) / cellSize_;
+        int cellsX = cvRound(image.cols * scale) / cellSize_;
+        if (cellsY * cellSize_ < blockSize_ || cellsX * cellSize_ < blockSize_) {
+            break;
+        }
+        HOGPyramidLevel level;
+        level.scale = scale;
+        level.approximated = k % scalesPerOctave != 0;
+        levels.push_back(std::move(level));
+    }
+
+    // Coarsest octave first, so that the full-size image stays in the descriptor at the end
+    int octaves = (static_cast<int>(levels.size()) - 1) / scalesPerOctave + 1;
+    for (int octave = octaves - 1; octave >= 0; octave--) {
+        HOGPyramidLevel& exact = levels[octave * scalesPerOctave];
+
+        // Exact gradients and cell histograms of the octave
+        cv::Mat octaveImage = sourceImage_;
+        if (octave > 0) {
+            cv::resize(octaveImage, octaveImage, cv::Size(cvRound(image.cols * exact.scale), cvRound(image.rows * exact.scale)), 0, 0, cv::INTER_AREA);
+        }
+        computeCellHistograms(octaveImage, workspace_.cellHistograms);
+        exact.cellHistograms = workspace_.cellHistograms;
+        std::span<const float> exactVector = calculateHOGVector(exact.cellHistograms);
+        exact.featureVector.assign(exactVector.begin(), exactVector.end());
+
+        // Intermediate scales of the octave are resampled from its cell histograms
+        for (int k = octave * scalesPerOctave + 1; k < std::min(static_cast<int>(levels.size()), (octave + 1) * scalesPerOctave); k++) {
+            HOGPyramidLevel& level = levels[k];
+            int rows = cvRound(image.rows * level.scale) / cellSize_;
+            int cols = cvRound(image.cols * level.scale) / cellSize_;
+            resampleCellHistograms(exact.cellHistograms, level.cellHistograms, rows, cols, level.scale / exact.scale, lambda);
+            std::span<const float> levelVector = calculateHOGVector(level.cellHistograms);
+            level.featureVector.assign(levelVector.begin(), levelVector.end());
+        }
+    }
+
+    // Keep the full-size results for the getters, the energies of updateHOG belong to the full-size cells
+    workspace_.featureVector = levels[0].featureVector;
+    computeCellEnergy(workspace_.cellHistograms);
+    frameKept_ = false;
+    keepSourceImage();
+    gradientFlag_ = false;
+    integralFlag_ = false;
     hogFlag_ = true;
+
+    return levels;
+}
+
+void HOGDescriptor::resampleCellHistograms(const CellHistograms& octave, CellHistograms& level, int rows, int cols, double ratio, double lambda){
+    level.resize(rows, cols, binNumber_);
+
+    // Every bin is one channel of the cell maps, area interpolation averages the covered cells
+    cv::Mat octaveMap(octave.rows(), octave.cols(), CV_32FC(binNumber_), const_cast<float*>(octave.data()));
+    cv::Mat levelMap(rows, cols, CV_32FC(binNumber_), level.data());
+    cv::resize(octaveMap, levelMap, levelMap.size(), 0, 0, cv::INTER_AREA);
+
+    // Gradients get stronger as the image shrinks, following the power law
+    float correction = static_cast<float>(std::pow(ratio, -lambda));
+    float* values = level.data();
+    for (size_t i = 0; i < level.size(); i++) {
+        values[i] *= correction;
+    }
+}
+
+void HOGDescriptor::setHistogramBackend(HistogramBackend backend){
+    histogramBackend_ = backend;
+}
+
+void HOGDescriptor::setFeatureLayout(FeatureLayout layout){
+    if (layout == FeatureLayout::COMPACT && (gradType_ != GRADIENT_SIGNED || binNumber_ % 2 != 0)){
+        throw std::invalid_argument("HOGDescriptor: compact layout requires signed gradients and an even binNumber");
+    }
+    featureLayout_ = layout;
+    frameKept_ = false;
+}
+
+void HOGDescriptor::setFeatureCache(std::shared_ptr<FeatureCache> cache){
+    featureCache_ = std::move(cache);
 }
 
-void HOGDescriptor::computeGradientFeatures(cv::Mat& image){
+HOGDescriptor::FeatureLayout HOGDescriptor::getFeatureLayout() const {
+    return featureLayout_;
+}
+
+void HOGDescriptor::setGrayscaleCheck(bool enabled){
+    grayscaleCheck_ = enabled;
+}
+
+void HOGDescriptor::setIntegerPipeline(bool enabled){
+    // 32-bit accumulators hold cellSize^2 fixed-point magnitudes of at most 64 * 255 * sqrt(2)
+    if (enabled && cellSize_ > 431){
+        throw std::invalid_argument("HOGDescriptor: integer pipeline requires cellSize <= 431");
+    }
+    integerPipeline_ = enabled;
+    frameKept_ = false;
+    if (enabled && binLookup_.empty()) {
+        binLookup_ = hogkernels::makeBinLookup({static_cast<float>(binWidth_), binNumber_, gradType_ == GRADIENT_SIGNED});
+    }
+}
+
+void HOGDescriptor::computeGradientFeatures(const cv::Mat& image){
+    StageScope stage(*this, HOGStats::GRADIENTS);
     // Compute each pixel's gradient magnitude and orientation
     // See https://learnopencv.com/histogram-of-oriented-gradients/
-    image.convertTo(image, CV_32F, 1/255.0);
-    cv::Mat gx, gy;
-    cv::Sobel(image, gx, CV_32F, 1, 0, 1);
-    cv::Sobel(image, gy, CV_32F, 0, 1, 1);
-    cartToPolar(gx, gy, imageMagnitude_, imageOrientation_, 1);
+    // Same [0, 1] pixel scale as the fused kernels
+    double scale = image.depth() == CV_8U ? 1/255.0 : (image.depth() == CV_16U ? 1/65535.0 : 1.0);
+    cv::Mat& gray = workspace_.gray;
+    image.convertTo(gray, CV_32F, scale);
+    // The channels of a grayscale image are equal, so the gradients of the first one are enough
+    if (gray.channels() > 1) {
+        cv::extractChannel(gray, gray, 0);
+    }
+    cv::Sobel(gray, workspace_.gradientX, CV_32F, 1, 0, 1);
+    cv::Sobel(gray, workspace_.gradientY, CV_32F, 0, 1, 1);
+    cartToPolar(workspace_.gradientX, workspace_.gradientY, imageMagnitude_, imageOrientation_, 1);
+    gradientFlag_ = true;
+    // Gray image and the two gradients written and read back, then the polar images
+    tally(stats_.bytesRead, matBytes(image) + 4 * matBytes(gray));
+    tally(stats_.bytesWritten, 5 * matBytes(gray));
 }
 
-std::vector<std::vector<std::vector<float>>> HOGDescriptor::computeCellHistograms(cv::Mat magnitude, cv::Mat orientation, std::vector<std::vector<std::vector<float>>>& cell_histograms){
+void HOGDescriptor::computeCellHistograms(const cv::Mat& image, CellHistograms& cell_histograms){
+    StageScope stage(*this, HOGStats::BINNING);
     
     // Cells number in each dimension
-    size_t cells_y = static_cast<int>(magnitude.rows / cellSize_);
-    size_t cells_x = static_cast<int>(magnitude.cols / cellSize_);
+    int cells_y = image.rows / cellSize_;
+    int cells_x = image.cols / cellSize_;
+
+    // One contiguous buffer for all the histograms, reused between calls of the same size
+    cell_histograms.resize(cells_y, cells_x, binNumber_);
+    tally(stats_.cells, static_cast<uint64_t>(cells_y) * cells_x);
+    tally(stats_.bytesRead, matBytes(image));
+    tally(stats_.bytesWritten, cell_histograms.size() * sizeof(float));
 
-    cell_histograms.resize(cells_y);
+    // Large images are binned in row bands of whole cells on the thread pool.
+    // binCells reads the one-pixel halo above and below a band straight from the image
+    // and sums every cell in the same order, so the result is bit-identical to one serial pass.
+    std::vector<HOGWorkspace::RowBuffers>& bands = workspace_.bands;
+    if (image.total() < PARALLEL_MIN_PIXELS) {
+        if (bands.empty()) {
+            bands.resize(1);
+        }
+        binCells(image, cv::Rect(0, 0, cells_x, cells_y), cell_histograms, bands[0]);
+        return;
+    }
 
-    // Iterate over each cell
-    for (size_t i = 0; i < cells_y; ++i) {
-        cell_histograms[i].resize(cells_x);
-        for (size_t j = 0; j < cells_x; ++j) {
-            // Create a cell matrix variable
-            cv::Rect cell = cv::Rect(cellSize_ * j, cellSize_ * i, cellSize_, cellSize_);
-            // Calculate its histogram
-            const std::vector<float> cell_histogram = cellHistogram(cv::Mat(imageMagnitude_, cell), cv::Mat(imageOrientation_, cell));
-            cell_histograms[i][j] = cell_histogram;
+    // Bands are fixed by the image size, each one keeps its row buffers from call to call
+    int bandRows = std::max(1, static_cast<int>(PARALLEL_MIN_PIXELS / 4 / (static_cast<size_t>(cellSize_) * image.cols)));
+    int bandCount = (cells_y + bandRows - 1) / bandRows;
+    if (bands.size() < static_cast<size_t>(bandCount)) {
+        bands.resize(bandCount);
+    }
+    auto bandLoop = [&](int begin, int end) {
+        for (int band = begin; band < end; ++band) {
+            int firstRow = band * bandRows;
+            cv::Rect cells(0, firstRow, cells_x, std::min(bandRows, cells_y - firstRow));
+            binCells(image, cells, cell_histograms, bands[band]);
         }
+    };
+    // Passed by reference, so std::function does not copy the lambda to the heap
+    ThreadPool::global().parallelFor(0, bandCount, std::cref(bandLoop));
+}
+
+void HOGDescriptor::binCells(const cv::Mat& image, const cv::Rect& cells, CellHistograms& cell_histograms, HOGWorkspace::RowBuffers& buffers){
+    if (integerPipeline_ && image.depth() == CV_8U) {
+        binCellsFixed(image, cells, cell_histograms, buffers);
+        return;
     }
 
-    return cell_histograms;
+    const int x0 = cells.x * cellSize_;
+    const int n = cells.width * cellSize_;
+    const hogkernels::BinningParams params{static_cast<float>(binWidth_), binNumber_, gradType_ == GRADIENT_SIGNED};
+    const hogkernels::GradientRowFn gradientRow = kernels_->gradientRow;
+    const hogkernels::AccumulateRowFn accumulateRow = kernels_->accumulateRow;
+    const RowLoader load = rowLoader(image.depth());
+
+    // Three float rows with their horizontal neighbours, the kernel never touches a full-image buffer
+    std::vector<float>& rows = buffers.rows;
+    std::vector<float>& magnitude = buffers.magnitude;
+    std::vector<int>& bin = buffers.bin;
+    rows.resize(3 * static_cast<size_t>(n + 2));
+    magnitude.resize(n);
+    bin.resize(n);
+    float* above = rows.data();
+    float* row = above + n + 2;
+    float* below = row + n + 2;
+
+    const int y0 = cells.y * cellSize_;
+    const int y1 = (cells.y + cells.height) * cellSize_;
+    load(image, reflectRow(y0 - 1, image.rows), x0, n, above);
+    load(image, y0, x0, n, row);
+    for (int y = y0; y < y1; ++y) {
+        load(image, reflectRow(y + 1, image.rows), x0, n, below);
+        gradientRow(above, row, below, n, params, magnitude.data(), bin.data());
+
+        // Add the row of every cell straight into its histogram
+        float* histogram = cell_histograms.row(y / cellSize_).data() + static_cast<size_t>(cells.x) * binNumber_;
+        accumulateRow(magnitude.data(), bin.data(), cells.width, cellSize_, binNumber_, histogram);
+
+        std::swap(above, row);
+        std::swap(row, below);
+    }
 }
 
-std::vector<float> HOGDescriptor::cellHistogram(const cv::Mat& cellMagnitude, const cv::Mat& cellOrientation){
-    std::vector<float> cell_histogram(binNumber_);
-    if(gradType_ == GRADIENT_SIGNED) {
-        // Iterate over each cells pixel for the histogram
-        for (size_t i = 0; i < cellMagnitude.rows; ++i) {
-            const float* rowMagnitude = cellMagnitude.ptr<float>(i);
-            const float* rowOrientation = cellOrientation.ptr<float>(i);
-            for (size_t j = 0; j < cellMagnitude.cols; ++j) {
-                cell_histogram.at(static_cast<int>(rowOrientation[j] / binWidth_)) += rowMagnitude[j];
+void HOGDescriptor::binCellsFixed(const cv::Mat& image, const cv::Rect& cells, CellHistograms& cell_histograms, HOGWorkspace::RowBuffers& buffers){
+    const int x0 = cells.x * cellSize_;
+    const int n = cells.width * cellSize_;
+    const float toFloat = static_cast<float>(1.0 / ((1 << hogkernels::FIXED_MAGNITUDE_SHIFT) * 255.0));
+
+    std::vector<int16_t>& rows = buffers.fixedRows;
+    std::vector<uint16_t>& magnitude = buffers.fixedMagnitude;
+    std::vector<uint8_t>& bin = buffers.fixedBin;
+    std::vector<uint32_t>& accumulator = buffers.accumulator;
+    rows.resize(3 * static_cast<size_t>(n + 2));
+    magnitude.resize(n);
+    bin.resize(n);
+    accumulator.assign(static_cast<size_t>(cells.width) * binNumber_, 0u);
+    int16_t* above = rows.data();
+    int16_t* row = above + n + 2;
+    int16_t* below = row + n + 2;
+
+    const int y0 = cells.y * cellSize_;
+    const int y1 = (cells.y + cells.height) * cellSize_;
+    loadRowFixed(image, reflectRow(y0 - 1, image.rows), x0, n, above);
+    loadRowFixed(image, y0, x0, n, row);
+    for (int y = y0; y < y1; ++y) {
+        loadRowFixed(image, reflectRow(y + 1, image.rows), x0, n, below);
+        hogkernels::gradientRowFixed(above, row, below, n, binLookup_.data(), magnitude.data(), bin.data());
+
+        kernels_->accumulateRowFixed(magnitude.data(), bin.data(), cells.width, cellSize_, binNumber_, accumulator.data());
+
+        // The last pixel row of a cell row turns the fixed-point sums into float histograms
+        if ((y + 1) % cellSize_ == 0) {
+            float* cellHistogram = cell_histograms.row(y / cellSize_).data() + static_cast<size_t>(cells.x) * binNumber_;
+            for (size_t i = 0; i < accumulator.size(); ++i) {
+                cellHistogram[i] += static_cast<float>(accumulator[i]) * toFloat;
             }
+            std::fill(accumulator.begin(), accumulator.end(), 0u);
         }
-    } else {
-        for (size_t i = 0; i < cellMagnitude.rows; ++i) {
-            const float* rowMagnitude = cellMagnitude.ptr<float>(i);
-            const float* rowOrientation = cellOrientation.ptr<float>(i);
-            for (size_t j = 0; j < cellMagnitude.cols; ++j) {
-                float orientation = rowOrientation[j];
-                if (orientation >= 180){
-                    orientation -= 180;
-                }
-                cell_histogram.at(orientation / binWidth_) += rowMagnitude[j];
+
+        std::swap(above, row);
+        std::swap(row, below);
+    }
+}
+
+void HOGDescriptor::computeIntegralHistograms(const cv::Mat& image, CellHistograms& cell_histograms){
+    StageScope stage(*this, HOGStats::BINNING);
+    buildIntegralImages(image);
+
+    // Cells of the regular grid are plain rectangle queries
+    int cells_y = image.rows / cellSize_;
+    int cells_x = image.cols / cellSize_;
+    cell_histograms.resize(cells_y, cells_x, binNumber_);
+    tally(stats_.cells, static_cast<uint64_t>(cells_y) * cells_x);
+    tally(stats_.bytesRead, 4 * cell_histograms.size() * sizeof(double));
+    tally(stats_.bytesWritten, cell_histograms.size() * sizeof(float));
+    for (int i = 0; i < cells_y; ++i) {
+        for (int j = 0; j < cells_x; ++j) {
+            rectHistogram(cv::Rect(cellSize_ * j, cellSize_ * i, cellSize_, cellSize_), cell_histograms(i, j));
+        }
+    }
+}
+
+void HOGDescriptor::buildIntegralImages(const cv::Mat& image){
+    const size_t bins = binNumber_;
+    const int n = image.cols;
+    const size_t rowStride = (n + 1) * bins;
+    const hogkernels::BinningParams params{static_cast<float>(binWidth_), binNumber_, gradType_ == GRADIENT_SIGNED};
+    const hogkernels::GradientRowFn gradientRow = kernels_->gradientRow;
+    const RowLoader load = rowLoader(image.depth());
+
+    if (workspace_.bands.empty()) {
+        workspace_.bands.resize(1);
+    }
+    HOGWorkspace::RowBuffers& buffers = workspace_.bands[0];
+    std::vector<float>& rows = buffers.rows;
+    std::vector<float>& magnitude = buffers.magnitude;
+    std::vector<int>& bin = buffers.bin;
+    std::vector<double>& rowSum = buffers.rowSum;
+    rows.resize(3 * static_cast<size_t>(n + 2));
+    magnitude.resize(n);
+    bin.resize(n);
+    rowSum.resize(bins);
+    float* above = rows.data();
+    float* row = above + n + 2;
+    float* below = row + n + 2;
+
+    // Row 0 and column 0 of the integral images stay zero
+    workspace_.integralHistogram.assign((image.rows + 1) * rowStride, 0.0);
+
+    load(image, reflectRow(-1, image.rows), 0, n, above);
+    load(image, 0, 0, n, row);
+    for (int y = 0; y < image.rows; ++y) {
+        load(image, reflectRow(y + 1, image.rows), 0, n, below);
+        gradientRow(above, row, below, n, params, magnitude.data(), bin.data());
+
+        const double* top = workspace_.integralHistogram.data() + y * rowStride + bins;
+        double* current = workspace_.integralHistogram.data() + (y + 1) * rowStride + bins;
+        std::fill(rowSum.begin(), rowSum.end(), 0.0);
+        for (int x = 0; x < n; ++x) {
+            rowSum[bin[x]] += magnitude[x];
+            for (size_t b = 0; b < bins; ++b) {
+                current[b] = top[b] + rowSum[b];
             }
+            top += bins;
+            current += bins;
         }
+
+        std::swap(above, row);
+        std::swap(row, below);
+    }
+    integralFlag_ = true;
+    tally(stats_.bytesRead, matBytes(image));
+    tally(stats_.bytesWritten, workspace_.integralHistogram.size() * sizeof(double));
+}
+
+void HOGDescriptor::rectHistogram(const cv::Rect& rect, std::span<float> histogram) const {
+    const size_t bins = binNumber_;
+    const size_t rowStride = (sourceImage_.cols + 1) * bins;
+    const double* top = workspace_.integralHistogram.data() + rect.y * rowStride;
+    const double* bottom = workspace_.integralHistogram.data() + (rect.y + rect.height) * rowStride;
+    const size_t left = rect.x * bins;
+    const size_t right = (rect.x + rect.width) * bins;
+
+    // Four lookups per bin regardless of the rectangle size
+    for (size_t bin = 0; bin < bins; ++bin) {
+        histogram[bin] = static_cast<float>(bottom[right + bin] - bottom[left + bin] - top[right + bin] + top[left + bin]);
     }
-    return cell_histogram;
 }
 
-std::vector<float> HOGDescriptor::getCellHistogram(int y, int x) {
+std::span<const float> HOGDescriptor::getCellHistogram(int y, int x) {
     if (!hogFlag_) {
         throw std::runtime_error("HOG vector is not computed yet!");
     }
 
-    if (y >= 0 && y < cellHistograms_.size() && x >= 0 && x < cellHistograms_[y].size()) {
-        return cellHistograms_[y][x];
+    if (y >= 0 && y < workspace_.cellHistograms.rows() && x >= 0 && x < workspace_.cellHistograms.cols()) {
+        return std::as_const(workspace_.cellHistograms)(y, x);
     } else {
         throw std::runtime_error("Invalid position!");
     }
 }
 
-std::vector<std::vector<float>> HOGDescriptor::getBlockHistogram(int y, int x) {
+std::vector<std::span<const float>> HOGDescriptor::getBlockHistogram(int y, int x) {
     if (!hogFlag_) {
         throw std::runtime_error("HOG vector is not computed yet!");
     }
 
     int numCellsInDirection = (blockSize_ / cellSize_);
 
-    if (y >= 0 && y < cellHistograms_.size() - numCellsInDirection && x >= 0 && x < cellHistograms_[y].size() - numCellsInDirection) {
-        std::vector<std::vector<float>> blockHistograms;
+    if (y >= 0 && y + numCellsInDirection <= workspace_.cellHistograms.rows() && x >= 0 && x + numCellsInDirection <= workspace_.cellHistograms.cols()) {
+        std::vector<std::span<const float>> blockHistograms;
+        blockHistograms.reserve(numCellsInDirection * numCellsInDirection);
 
         for (int i = y; i < y + numCellsInDirection; i++) {
             for (int j = x; j < x + numCellsInDirection; j++) {
-                if (i >= 0 && i < cellHistograms_.size() && j >= 0 && j < cellHistograms_[i].size()) {
-                    blockHistograms.push_back(getCellHistogram(i, j));
-                } else {
-                    throw std::runtime_error("Invalid position within the block!");
-                }
+                blockHistograms.push_back(std::as_const(workspace_.cellHistograms)(i, j));
             }
         }
 
@@ -186,54 +1434,299 @@ std::vector<std::vector<float>> HOGDescriptor::getBlockHistogram(int y, int x) {
     }
 }
 
+std::vector<float> HOGDescriptor::getCellHistogram(const cv::Point& offset) {
+    if (!hogFlag_) {
+        throw std::runtime_error("HOG vector is not computed yet!");
+    }
+    if (offset.x < 0 || offset.y < 0 || offset.x + cellSize_ > sourceImage_.cols || offset.y + cellSize_ > sourceImage_.rows) {
+        throw std::runtime_error("Invalid position!");
+    }
+    if (!integralFlag_) {
+        buildIntegralImages(sourceImage_);
+    }
+
+    std::vector<float> histogram(binNumber_);
+    rectHistogram(cv::Rect(offset.x, offset.y, cellSize_, cellSize_), histogram);
+    return histogram;
+}
+
+std::vector<float> HOGDescriptor::getBlockHistogram(const cv::Point& offset) {
+    if (!hogFlag_) {
+        throw std::runtime_error("HOG vector is not computed yet!");
+    }
+    if (offset.x < 0 || offset.y < 0 || offset.x + blockSize_ > sourceImage_.cols || offset.y + blockSize_ > sourceImage_.rows) {
+        throw std::runtime_error("Invalid position!");
+    }
+    if (!integralFlag_) {
+        buildIntegralImages(sourceImage_);
+    }
+
+    int numCellsInDirection = (blockSize_ / cellSize_);
+    std::vector<float> blockHistogram(static_cast<size_t>(numCellsInDirection) * numCellsInDirection * binNumber_);
+    float* cell = blockHistogram.data();
+    for (int i = 0; i < numCellsInDirection; i++) {
+        for (int j = 0; j < numCellsInDirection; j++) {
+            rectHistogram(cv::Rect(offset.x + j * cellSize_, offset.y + i * cellSize_, cellSize_, cellSize_), std::span<float>(cell, binNumber_));
+            cell += binNumber_;
+        }
+    }
+    return blockHistogram;
+}
+
 std::vector<float> HOGDescriptor::getHOGFeatureVector(){
     if (hogFlag_ == false){
         throw std::runtime_error("HOG vector is not computed yet!");
     }
-    return hogFeatureVector_;
+    CallScope call(*this, "getHOGFeatureVector");
+    StageScope stage(*this, HOGStats::OUTPUT);
+    tally(stats_.bytesRead, workspace_.featureVector.size() * sizeof(float));
+    tally(stats_.bytesWritten, workspace_.featureVector.size() * sizeof(float));
+    return workspace_.featureVector;
 }
 
-const std::vector<float> HOGDescriptor::calculateHOGVector(const std::vector<std::vector<std::vector<float>>>& cell_histograms) {
-    std::vector<float> hog_vector;
+QuantizedVector HOGDescriptor::getHOGFeatureVector(HOGValueType type){
+    if (hogFlag_ == false){
+        throw std::runtime_error("HOG vector is not computed yet!");
+    }
+    CallScope call(*this, "getHOGFeatureVector");
+    StageScope stage(*this, HOGStats::OUTPUT);
+    QuantizedVector quantized = quant::quantize(workspace_.featureVector, type, featureGroupLength());
+    tally(stats_.bytesRead, workspace_.featureVector.size() * sizeof(float));
+    tally(stats_.bytesWritten, quantized.bytes());
+    return quantized;
+}
 
-    int imageWidth = cell_histograms[0].size() * cellSize_;
-    int imageHeight = cell_histograms.size() * cellSize_;
+std::span<const float> HOGDescriptor::getHOGFeatureView() const {
+    if (hogFlag_ == false){
+        throw std::runtime_error("HOG vector is not computed yet!");
+    }
+    return workspace_.featureVector;
+}
+
+const CellHistograms& HOGDescriptor::getCellHistograms() const {
+    if (hogFlag_ == false){
+        throw std::runtime_error("HOG vector is not computed yet!");
+    }
+    return workspace_.cellHistograms;
+}
+
+void HOGDescriptor::fillBlock(const CellHistograms& cell_histograms, int y, int x, std::span<float> block_histogram){
+    int numCellsInDirection = blockSize_ / cellSize_;
+    float* block = block_histogram.data();
+
+    // Blocks off the cell grid are queried at their exact pixel offsets
+    bool offGrid = stride_ % cellSize_ != 0;
+
+    if (offGrid) {
+        float* cell = block;
+        for (int i = 0; i < numCellsInDirection; i++) {
+            for (int j = 0; j < numCellsInDirection; j++) {
+                cv::Rect rect(x * stride_ + j * cellSize_, y * stride_ + i * cellSize_, cellSize_, cellSize_);
+                rectHistogram(rect, std::span<float>(cell, binNumber_));
+                cell += binNumber_;
+            }
+        }
+        normalizeBlockHistogram(block_histogram);
+    } else {
+        // Cells of one block row are adjacent in memory, so copy them at once
+        int firstCellY = y * stride_ / cellSize_;
+        int firstCellX = x * stride_ / cellSize_;
+        size_t rowStride = static_cast<size_t>(cell_histograms.cols()) * binNumber_;
+        kernels_->copyBlock(cell_histograms(firstCellY, firstCellX).data(), rowStride, numCellsInDirection, binNumber_, block);
+
+        // The cell energies were reduced once for the whole grid
+        const float* energy = workspace_.cellEnergy.data() + static_cast<size_t>(firstCellY) * cell_histograms.cols() + firstCellX;
+        normalizeBlockHistogram(block_histogram, blockEnergy(energy, cell_histograms.cols(), numCellsInDirection));
+    }
+}
+
+std::span<const float> HOGDescriptor::calculateHOGVector(const CellHistograms& cell_histograms) {
+    if (featureLayout_ == FeatureLayout::COMPACT) {
+        return calculateCompactVector(cell_histograms);
+    }
+    StageScope stage(*this, HOGStats::NORMALIZATION);
+    int imageWidth = cell_histograms.cols() * cellSize_;
+    int imageHeight = cell_histograms.rows() * cellSize_;
     int blocksX = (imageWidth - blockSize_) / stride_ + 1;
     int blocksY = (imageHeight - blockSize_) / stride_ + 1;
 
+    int numCellsInDirection = blockSize_ / cellSize_;
+    size_t rowLength = static_cast<size_t>(numCellsInDirection) * binNumber_;
+    size_t blockLength = rowLength * numCellsInDirection;
+
+    if (stride_ % cellSize_ == 0) {
+        computeCellEnergy(cell_histograms);
+    }
+
+    // The final vector is sized once, every block is written straight into its slot
+    workspace_.featureVector.resize(static_cast<size_t>(blocksX) * blocksY * blockLength);
+    tally(stats_.blocks, static_cast<uint64_t>(blocksX) * blocksY);
+    tally(stats_.bytesRead, workspace_.featureVector.size() * sizeof(float));
+    tally(stats_.bytesWritten, workspace_.featureVector.size() * sizeof(float));
+
+    // Every block row writes its own slice of the final vector
+    auto blockRows = [&](int rowBegin, int rowEnd) {
+        float* block = workspace_.featureVector.data() + static_cast<size_t>(rowBegin) * blocksX * blockLength;
+        for (int y = rowBegin; y < rowEnd; y++) {
+            for (int x = 0; x < blocksX; x++) {
+                fillBlock(cell_histograms, y, x, std::span<float>(block, blockLength));
+                block += blockLength;
+            }
+        }
+    };
+
     // Iterate over each block
-    for (int y = 0; y < blocksY; y++) {
-        for (int x = 0; x < blocksX; x++) {
-            std::vector<float> blockHistogram;
-
-            // Iterate over each cell in the block
-            for (int i = y * stride_ / cellSize_; i < (y * stride_ + blockSize_) / cellSize_; i++) {
-                for (int j = x * stride_ / cellSize_; j < (x * stride_ + blockSize_) / cellSize_; j++){
-                    blockHistogram.insert(blockHistogram.end(), cell_histograms[i][j].begin(), cell_histograms[i][j].end());
+    size_t pixels = static_cast<size_t>(imageWidth) * imageHeight;
+    if (pixels < PARALLEL_MIN_PIXELS) {
+        blockRows(0, blocksY);
+    } else {
+        int rowsPerChunk = std::max(1, static_cast<int>(PARALLEL_MIN_PIXELS / 4 / (static_cast<size_t>(stride_) * imageWidth)));
+        ThreadPool::global().parallelFor(0, blocksY, std::cref(blockRows), rowsPerChunk);
+    }
+
+    return workspace_.featureVector;
+}
+
+std::span<const float> HOGDescriptor::calculateCompactVector(const CellHistograms& cell_histograms) {
+    StageScope stage(*this, HOGStats::NORMALIZATION);
+    const int cellsY = cell_histograms.rows();
+    const int cellsX = cell_histograms.cols();
+    const size_t bins = binNumber_;
+    const size_t half = bins / 2;
+    const size_t length = featureGroupLength();
+    const float textureWeight = 1.0f / std::sqrt(static_cast<float>(bins));
+    if (cellsY < 3 || cellsX < 3) {
+        workspace_.featureVector.clear();
+        return workspace_.featureVector;
+    }
+    const int outY = cellsY - 2;
+    const int outX = cellsX - 2;
+    const int normsX = cellsX - 1;
+
+    workspace_.cellEnergy.resize(static_cast<size_t>(cellsY) * cellsX);
+    workspace_.blockNorms.resize(static_cast<size_t>(cellsY - 1) * normsX);
+    workspace_.featureVector.resize(static_cast<size_t>(outY) * outX * length);
+    tally(stats_.blocks, static_cast<uint64_t>(cellsY - 1) * normsX);
+    tally(stats_.bytesRead, cell_histograms.size() * sizeof(float));
+    tally(stats_.bytesWritten, workspace_.featureVector.size() * sizeof(float));
+
+    // Energy of the unsigned histogram of every cell, opposite orientations summed
+    auto energyRows = [&](int rowBegin, int rowEnd) {
+        for (int y = rowBegin; y < rowEnd; y++) {
+            const float* cell = cell_histograms(y, 0).data();
+            float* energy = workspace_.cellEnergy.data() + static_cast<size_t>(y) * cellsX;
+            for (int x = 0; x < cellsX; x++, cell += bins) {
+                float sum = 0.0f;
+                for (size_t o = 0; o < half; o++) {
+                    float value = cell[o] + cell[o + half];
+                    sum += value * value;
                 }
+                energy[x] = sum;
             }
-            // Block normalization (L2-Hys)
-            normalizeBlockHistogram(blockHistogram);
+        }
+    };
 
-            // Add the block vector to the final vector
-            hog_vector.insert(hog_vector.end(), blockHistogram.begin(), blockHistogram.end());
+    // Inverse norm of every 2 x 2 block of cells, shared by the four cells of the block
+    auto normRows = [&](int rowBegin, int rowEnd) {
+        for (int y = rowBegin; y < rowEnd; y++) {
+            const float* top = workspace_.cellEnergy.data() + static_cast<size_t>(y) * cellsX;
+            const float* bottom = top + cellsX;
+            float* norm = workspace_.blockNorms.data() + static_cast<size_t>(y) * normsX;
+            for (int x = 0; x < normsX; x++) {
+                norm[x] = 1.0f / std::sqrt(top[x] + top[x + 1] + bottom[x] + bottom[x + 1] + COMPACT_EPS);
+            }
         }
+    };
+
+    // Every interior cell is normalized by the blocks below right, above right, below left and above left of it
+    auto featureRows = [&](int rowBegin, int rowEnd) {
+        for (int y = rowBegin; y < rowEnd; y++) {
+            const float* cell = cell_histograms(y + 1, 1).data();
+            const float* below = workspace_.blockNorms.data() + static_cast<size_t>(y + 1) * normsX + 1;
+            const float* above = workspace_.blockNorms.data() + static_cast<size_t>(y) * normsX + 1;
+            float* features = workspace_.featureVector.data() + static_cast<size_t>(y) * outX * length;
+            for (int x = 0; x < outX; x++, cell += bins, features += length) {
+                const float n1 = below[x], n2 = above[x], n3 = below[x - 1], n4 = above[x - 1];
+                float t1 = 0.0f, t2 = 0.0f, t3 = 0.0f, t4 = 0.0f;
+                for (size_t o = 0; o < bins; o++) {
+                    float h1 = std::min(cell[o] * n1, COMPACT_CLIP);
+                    float h2 = std::min(cell[o] * n2, COMPACT_CLIP);
+                    float h3 = std::min(cell[o] * n3, COMPACT_CLIP);
+                    float h4 = std::min(cell[o] * n4, COMPACT_CLIP);
+                    features[o] = 0.5f * (h1 + h2 + h3 + h4);
+                    t1 += h1;
+                    t2 += h2;
+                    t3 += h3;
+                    t4 += h4;
+                }
+                for (size_t o = 0; o < half; o++) {
+                    float sum = cell[o] + cell[o + half];
+                    float h1 = std::min(sum * n1, COMPACT_CLIP);
+                    float h2 = std::min(sum * n2, COMPACT_CLIP);
+                    float h3 = std::min(sum * n3, COMPACT_CLIP);
+                    float h4 = std::min(sum * n4, COMPACT_CLIP);
+                    features[bins + o] = 0.5f * (h1 + h2 + h3 + h4);
+                }
+                float* texture = features + bins + half;
+                texture[0] = textureWeight * t1;
+                texture[1] = textureWeight * t2;
+                texture[2] = textureWeight * t3;
+                texture[3] = textureWeight * t4;
+            }
+        }
+    };
+
+    size_t pixels = static_cast<size_t>(cellsY) * cellsX * cellSize_ * cellSize_;
+    if (pixels < PARALLEL_MIN_PIXELS) {
+        energyRows(0, cellsY);
+        normRows(0, cellsY - 1);
+        featureRows(0, outY);
+    } else {
+        int rowsPerChunk = std::max(1, static_cast<int>(PARALLEL_MIN_PIXELS / 4 / (static_cast<size_t>(cellSize_) * cellSize_ * cellsX)));
+        ThreadPool::global().parallelFor(0, cellsY, std::cref(energyRows), rowsPerChunk);
+        ThreadPool::global().parallelFor(0, cellsY - 1, std::cref(normRows), rowsPerChunk);
+        ThreadPool::global().parallelFor(0, outY, std::cref(featureRows), rowsPerChunk);
     }
 
-    return hog_vector;
+    return workspace_.featureVector;
 }
 
-void HOGDescriptor::normalizeBlockHistogram(std::vector<float>& block_histogram) {
-    //L2-hys normalization
-    float sumOfSquares = 0.0;
-    for (float value : block_histogram) {
-        sumOfSquares += value * value;
+size_t HOGDescriptor::featureGroupLength() const {
+    if (featureLayout_ == FeatureLayout::COMPACT) {
+        return binNumber_ + binNumber_ / 2 + 4;
     }
-    float eps = 1e-5; // Small constant for numerical stability
-    float sqrtSumOfSquares = std::sqrt(sumOfSquares + eps);
-    for (float& value : block_histogram) {
-        value /= sqrtSumOfSquares;
-        value = std::min(value, 0.5f);
+    size_t cellsPerBlock = blockSize_ / cellSize_;
+    return cellsPerBlock * cellsPerBlock * binNumber_;
+}
+
+void HOGDescriptor::normalizeBlockHistogram(std::span<float> block_histogram) {
+    // Same sum of per-cell energies as the blocks of the cell grid
+    float energy = 0.0f;
+    for (size_t offset = 0; offset + binNumber_ <= block_histogram.size(); offset += binNumber_) {
+        float cellEnergy;
+        kernels_->cellEnergy(block_histogram.data() + offset, 1, binNumber_, &cellEnergy);
+        energy += cellEnergy;
+    }
+    normalizeBlockHistogram(block_histogram, energy);
+}
+
+void HOGDescriptor::normalizeBlockHistogram(std::span<float> block_histogram, float energy) {
+    kernels_->normalizeBlock(block_histogram.data(), block_histogram.size(), energy);
+}
+
+void HOGDescriptor::computeCellEnergy(const CellHistograms& cell_histograms) {
+    const size_t cells = static_cast<size_t>(cell_histograms.rows()) * cell_histograms.cols();
+    workspace_.cellEnergy.resize(cells);
+    auto cellRows = [&](int rowBegin, int rowEnd) {
+        kernels_->cellEnergy(cell_histograms.data() + static_cast<size_t>(rowBegin) * cell_histograms.cols() * binNumber_,
+                             static_cast<size_t>(rowEnd - rowBegin) * cell_histograms.cols(), binNumber_,
+                             workspace_.cellEnergy.data() + static_cast<size_t>(rowBegin) * cell_histograms.cols());
+    };
+    if (cells * cellSize_ * cellSize_ < PARALLEL_MIN_PIXELS) {
+        cellRows(0, cell_histograms.rows());
+    } else {
+        int rowsPerChunk = std::max(1, static_cast<int>(PARALLEL_MIN_PIXELS / 4 / (static_cast<size_t>(cellSize_) * cellSize_ * cell_histograms.cols())));
+        ThreadPool::global().parallelFor(0, cell_histograms.rows(), std::cref(cellRows), rowsPerChunk);
     }
 }
 
@@ -241,33 +1734,43 @@ void HOGDescriptor::visualizeHOG(float scale, bool imposed) {
     if (hogFlag_ == false){
         throw std::runtime_error("HOG vector is not computed yet!");
     }
+    CallScope call(*this, "visualizeHOG");
     cv::Mat visualization;
 
     // Create a visualization image
     if (imposed == true){
+        // The fused kernels do not keep the magnitude image, compute it for the background
+        if (!gradientFlag_) {
+            computeGradientFeatures(sourceImage_);
+        }
         visualization = imageMagnitude_.clone();
     }
     else {
-        visualization.create(imageMagnitude_.rows, imageMagnitude_.cols, CV_8UC3);
+        visualization.create(sourceImage_.rows, sourceImage_.cols, CV_8UC3);
         visualization.setTo(cv::Scalar(0, 0, 0));
     }
 
     // Calculate cells number in the image
-    int cellsX = cellHistograms_[0].size();
-    int cellsY = cellHistograms_.size();
+    int cellsX = workspace_.cellHistograms.cols();
+    int cellsY = workspace_.cellHistograms.rows();
+
+    // Scratch buffer for the block around each cell, allocated once for the whole image
+    int numCellDirections = (blockSize_ / cellSize_);
+    std::vector<float> blockScratch;
+    blockScratch.reserve(static_cast<size_t>(numCellDirections) * numCellDirections * binNumber_);
 
     // Iterate over each cell in the image
     for (int y = 0; y < cellsY; y++) {
         for (int x = 0; x < cellsX; x++) {
 
-            std::vector<float> cellHistogram;
+            blockScratch.clear();
             
             // Add all the cells in the cells block to the cell vector
-            int numCellDirections = (blockSize_ / cellSize_);
             for (int i = 0; i < numCellDirections; i++) {
                 for (int j = 0; j < numCellDirections; j++) {
                     if (y+i >= 0 && y+i < cellsY && x+j >= 0 && x+j < cellsX){
-                        cellHistogram.insert(cellHistogram.end(), cellHistograms_[y+i][x+j].begin(), cellHistograms_[y+i][x+j].end());
+                        std::span<const float> neighbour = std::as_const(workspace_.cellHistograms)(y+i, x+j);
+                        blockScratch.insert(blockScratch.end(), neighbour.begin(), neighbour.end());
                     }
                 }
             }
@@ -277,10 +1780,10 @@ void HOGDescriptor::visualizeHOG(float scale, bool imposed) {
             // To achieve at least approximately correct rendering,
             // we apply to each cell, in which we want to draw a visualization of its histogram in the form of arrows,
             // normalization of the block where it participates
-            normalizeBlockHistogram(cellHistogram);
+            normalizeBlockHistogram(blockScratch);
 
-            // Remove other cell from vector
-            cellHistogram.erase(cellHistogram.begin() + binNumber_, cellHistogram.end());
+            // Only the first cell of the block is drawn
+            std::span<const float> cellHistogram(blockScratch.data(), binNumber_);
 
             // Calculate cell position on the visualization image
             int cellX = x * cellSize_;
@@ -352,10 +1855,16 @@ void HOGDescriptor::saveVectorData(const std::string& executablePath, const std:
         return;
     }
 
-    std::vector<float> hogVector = getHOGFeatureVector();
-    for (int i = 0; i < hogVector.size(); i++) {
-        file << hogVector[i] << " ";
+    if (hogFlag_ == false){
+        throw std::runtime_error("HOG vector is not computed yet!");
+    }
+    CallScope call(*this, "saveVectorData");
+    StageScope stage(*this, HOGStats::OUTPUT);
+    for (float value : workspace_.featureVector) {
+        file << value << " ";
     }
+    tally(stats_.bytesRead, workspace_.featureVector.size() * sizeof(float));
+    tally(stats_.bytesWritten, static_cast<uint64_t>(std::max<std::streamoff>(0, file.tellp())));
     file.close();
     
     std::cout << "HOG вектор сохранен!" << std::endl;
@@ -0,0 +1,140 @@
+#ifndef HOGFEATURECACHE_H
+#define HOGFEATURECACHE_H
+
+#include "hogdescriptor.hpp"
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+#include <list>
+#include <mutex>
+#include <span>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * @brief On-disk cache of computeHOG results, addressed by the content of the images
+ *
+ * Every entry is one file of the cache directory holding the cell histograms and the feature
+ * vector of an image, named after a 64-bit hash of the pixels, the image geometry and type and
+ * every setting of the descriptor that changes the results. A hit maps the file and copies
+ * the results into the descriptor instead of computing them, it refreshes the modification time
+ * of the file at most once a minute. Entries are written to a temporary
+ * file and renamed, so several processes may share a directory. When the entries exceed the size
+ * cap the least recently used ones are deleted, the use order survives restarts as the
+ * modification times of the files. The index is kept in memory, the directory is listed again only
+ * when a store takes the entries beyond the cap, then the least recently used files of every process
+ * sharing the directory are deleted down to 90% of the cap.
+ *
+ * The methods may be called from several threads, e.g. by the descriptors of computeHOGBatch.
+ */
+class FeatureCache {
+public:
+    /**
+     * @brief Open a cache directory, created if missing
+     *
+     * @param directory Cache directory
+     * @param maxBytes Size cap of the entries in bytes, the oldest entries are deleted beyond it
+     */
+    FeatureCache(const std::string& directory, uint64_t maxBytes);
+
+    FeatureCache(const FeatureCache&) = delete;
+    FeatureCache& operator=(const FeatureCache&) = delete;
+
+    /**
+     * @brief Key of an image computed with the given settings
+     *
+     * @param image Input image, any depth and number of channels
+     * @param settings Values of every setting of the descriptor that changes the results
+     */
+    static uint64_t key(const cv::Mat& image, std::span<const int64_t> settings);
+
+    /**
+     * @brief Read the results of a key
+     *
+     * @param key Key of the image and settings
+     * @param cellHistograms Output cell histograms, reshaped to the cached grid
+     * @param featureVector Output feature vector
+     * @return True on a hit, the outputs are left untouched on a miss
+     */
+    bool load(uint64_t key, CellHistograms& cellHistograms, std::vector<float>& featureVector);
+
+    /**
+     * @brief Write the results of a key, evicting the least recently used entries beyond the size cap
+     *
+     * @param key Key of the image and settings
+     * @param cellHistograms Cell histograms of the image
+     * @param featureVector Feature vector of the image
+     * @return False if the entry is larger than the cap or could not be written
+     */
+    bool store(uint64_t key, const CellHistograms& cellHistograms, std::span<const float> featureVector);
+
+    /**
+     * @brief Delete every entry
+     */
+    void clear();
+
+    uint64_t bytes() const; //!< Size of the indexed entries in bytes, other processes' entries as of the last eviction
+    size_t count() const; //!< Number of the indexed entries, other processes' entries as of the last eviction
+    uint64_t maxBytes() const { return maxBytes_; } //!< Size cap of the entries in bytes
+    uint64_t hits() const { return hits_; } //!< Number of loads that found their entry
+    uint64_t misses() const { return misses_; } //!< Number of loads that did not
+
+private:
+    /**
+     * @brief Entry of the in-memory index
+     */
+    struct Entry {
+        std::list<uint64_t>::iterator use; //!< Position in the use order
+        uint64_t bytes; //!< Size of the entry file
+        std::filesystem::file_time_type used; //!< Last use by this object, or the modification time of the file
+        std::filesystem::file_time_type fileTime; //!< Modification time of the file, as last set or found by this object
+    };
+
+    /**
+     * @brief Path of the entry file of a key
+     */
+    std::string entryPath(uint64_t key) const;
+
+    /**
+     * @brief Record a use of an entry, adding it to the index if another process wrote it
+     *
+     * @param key Key of the entry
+     * @param bytes Size of the entry file
+     * @return True if the modification time of the file is a minute old or unknown, it is taken as refreshed now
+     */
+    bool touch(uint64_t key, uint64_t bytes);
+
+    /**
+     * @brief Drop an entry from the index and delete its file
+     *
+     * @param key Key of the entry
+     */
+    void erase(uint64_t key);
+
+    /**
+     * @brief Rebuild the index from the entry files of the directory, with the mutex held
+     *
+     * Temporary files of stores in progress count towards the size, the ones older than ten minutes
+     * were left by a process that died while writing and are deleted.
+     */
+    void scan();
+
+    /**
+     * @brief List the directory, then delete the least recently used entries down to 90% of the size cap, with the mutex held
+     */
+    void evict();
+
+    std::string directory_; //!< Cache directory
+    uint64_t maxBytes_; //!< Size cap of the entries in bytes
+    uint64_t tag_; //!< Random tag of the temporary files of this cache object
+    mutable std::mutex mutex_; //!< Guards the index
+    std::list<uint64_t> useOrder_; //!< Keys from the most to the least recently used
+    std::unordered_map<uint64_t, Entry> entries_; //!< Index of the entries
+    uint64_t bytes_ = 0; //!< Size of the indexed entries and of the temporary files found by the last scan in bytes
+    std::atomic<uint64_t> temporaries_{0}; //!< Number of temporary files written
+    std::atomic<uint64_t> hits_{0}; //!< Number of hits
+    std::atomic<uint64_t> misses_{0}; //!< Number of misses
+};
+
+#endif //HOGFEATURECACHE_H
@@ -0,0 +1,209 @@
+#ifndef HOGFEATURESTORE_H
+#define HOGFEATURESTORE_H
+
+#include "hogdescriptor.hpp"
+#include "mappedfile.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <initializer_list>
+#include <span>
+#include <string>
+#include <vector>
+
+/**
+ * @brief Header of a binary feature store file, 64 bytes, little-endian
+ *
+ * The header is followed by the records, stored one after the other from byte 64, and by the index,
+ * one int64 label per record at indexOffset. A record holds vectorLength values of valueType:
+ * - FLOAT32: the floats;
+ * - FLOAT16: the halves;
+ * - UINT8: one float scale per block, or per cell of the compact layout, then the codes.
+ * Every record is padded with zeros to a multiple of 64 bytes, so all of them start on a 64-byte
+ * boundary and a mapped file can be read in place as a matrix with aligned rows.
+ */
+struct FeatureStoreHeader {
+    char magic[8]; //!< "HOGSTORE"
+    uint32_t version; //!< Format version
+    uint32_t headerSize; //!< Size of the header in bytes
+    int32_t blockSize; //!< Block size of the descriptor
+    int32_t cellSize; //!< Cell size of the descriptor
+    int32_t stride; //!< Block stride of the descriptor
+    int32_t binNumber; //!< Number of the bins of the descriptor
+    int32_t gradType; //!< Gradient type of the descriptor (180 or 360)
+    uint16_t valueType; //!< Type of the stored values, a HOGValueType
+    uint8_t layout; //!< Layout of the feature vectors, a HOGDescriptor::FeatureLayout
+    uint8_t normType; //!< Block normalization of the descriptor, a HOGDescriptor::NormType
+    uint64_t vectorLength; //!< Number of values in each record
+    uint64_t count; //!< Number of records
+    uint64_t indexOffset; //!< Byte offset of the label index
+};
+
+/**
+ * @brief Writer of binary feature store files
+ *
+ * Records are buffered by the stream and written as raw values, converted to the value type
+ * of the store on the way, the index and the record count are written on close.
+ * Opening an existing store appends to it, the store reads as not closed until close() is called.
+ */
+class FeatureStoreWriter {
+public:
+    /**
+     * @brief Create a store, or open an existing one for appending
+     *
+     * @param path Path of the store file
+     * @param params Parameters of the descriptor that computed the features
+     * @param vectorLength Number of values in each feature vector
+     * @param valueType Type of the stored values, UINT8 needs vectors made of whole blocks (or cells of the compact layout)
+     * @param layout Layout of the feature vectors
+     * @param normType Block normalization of the descriptor
+     */
+    FeatureStoreWriter(const std::string& path, const HOGParameters& params, size_t vectorLength,
+                       HOGValueType valueType = HOGValueType::FLOAT32,
+                       HOGDescriptor::FeatureLayout layout = HOGDescriptor::FeatureLayout::BLOCKS,
+                       HOGDescriptor::NormType normType = HOGDescriptor::NormType::L2_CLIPPED);
+    /**
+     * @brief Create a store for the features of a descriptor, or open an existing one for appending
+     *
+     * @param path Path of the store file
+     * @param hog Descriptor that computes the features, its parameters, layout and normalization are stored
+     * @param vectorLength Number of values in each feature vector
+     * @param valueType Type of the stored values
+     */
+    FeatureStoreWriter(const std::string& path, const HOGDescriptor& hog, size_t vectorLength,
+                       HOGValueType valueType = HOGValueType::FLOAT32);
+    /**
+     * @brief Close the store if it is still open
+     */
+    ~FeatureStoreWriter();
+
+    FeatureStoreWriter(const FeatureStoreWriter&) = delete;
+    FeatureStoreWriter& operator=(const FeatureStoreWriter&) = delete;
+
+    /**
+     * @brief Append one feature vector
+     *
+     * @param features Feature vector of vectorLength values
+     * @param label Label stored in the index for the record
+     */
+    void append(std::span<const float> features, int64_t label = 0);
+
+    /**
+     * @brief Append one feature vector already quantized to the value type of the store
+     *
+     * @param features Feature vector of vectorLength values, for example HOGDescriptor::getHOGFeatureVector(type)
+     * @param label Label stored in the index for the record
+     */
+    void append(const QuantizedVector& features, int64_t label = 0);
+
+    /**
+     * @brief Append every row of a CV_32F matrix, for example the output of computeHOGBatch
+     *
+     * @param features Matrix with one feature vector in each row
+     * @param labels Label of each row, empty for all zero
+     */
+    void append(const cv::Mat& features, std::span<const int64_t> labels = {});
+
+    /**
+     * @brief Write the index and the header, no more records can be appended
+     */
+    void close();
+
+    /**
+     * @brief Number of records in the store
+     */
+    size_t size() const { return labels_.size(); }
+
+private:
+    /**
+     * @brief Write one record and add its label to the index
+     *
+     * @param parts Byte runs making up the record, without the padding
+     * @param label Label of the record
+     */
+    void writeRecord(std::initializer_list<std::span<const std::byte>> parts, int64_t label);
+
+    std::fstream file_; //!< Store file
+    FeatureStoreHeader header_; //!< Header written on close
+    std::vector<int64_t> labels_; //!< Label index of all the records
+    size_t recordSize_ = 0; //!< Bytes taken by one record
+    size_t groupLength_ = 0; //!< Number of values sharing one scale in UINT8 records
+    QuantizedVector scratch_; //!< Quantized copy of the record being appended
+};
+
+/**
+ * @brief Read-only view of a feature store file mapped into memory
+ *
+ * Records are read straight from the mapping, nothing is copied.
+ */
+class FeatureStoreReader {
+public:
+    /**
+     * @brief Map a store file
+     *
+     * @param path Path of the store file
+     */
+    explicit FeatureStoreReader(const std::string& path);
+
+    FeatureStoreReader(const FeatureStoreReader&) = delete;
+    FeatureStoreReader& operator=(const FeatureStoreReader&) = delete;
+
+    /**
+     * @brief Parameters of the descriptor that computed the features
+     */
+    HOGParameters parameters() const;
+
+    size_t size() const { return header_->count; } //!< Number of records
+    size_t vectorLength() const { return header_->vectorLength; } //!< Number of values in each record
+    HOGValueType valueType() const { return static_cast<HOGValueType>(header_->valueType); } //!< Type of the stored values
+    HOGDescriptor::FeatureLayout layout() const { return static_cast<HOGDescriptor::FeatureLayout>(header_->layout); } //!< Layout of the feature vectors
+    HOGDescriptor::NormType normType() const { return static_cast<HOGDescriptor::NormType>(header_->normType); } //!< Block normalization of the descriptor
+
+    /**
+     * @brief View of one feature vector of a FLOAT32 store
+     *
+     * @param i Record index
+     */
+    std::span<const float> operator[](size_t i) const;
+
+    /**
+     * @brief Convert one feature vector of a store of any value type to floats
+     *
+     * @param i Record index
+     * @param features Output feature vector of vectorLength values
+     */
+    void decode(size_t i, std::span<float> features) const;
+
+    /**
+     * @brief Label of one record
+     *
+     * @param i Record index
+     */
+    int64_t label(size_t i) const;
+
+    /**
+     * @brief All the records as a size() x vectorLength() matrix over the mapping
+     *
+     * CV_32F, CV_16F or CV_8U (the codes) depending on the value type. The matrix does not own
+     * the data and is valid while the reader exists. Rows start on 64-byte boundaries, one padded
+     * record apart, so the matrix is not continuous unless the records need no padding.
+     */
+    cv::Mat matrix() const;
+
+    /**
+     * @brief Scales of the records of a UINT8 store, a size() x blocks CV_32F matrix over the mapping
+     *
+     * Empty for the other value types.
+     */
+    cv::Mat scales() const;
+
+private:
+    MappedFile file_; //!< Mapping of the store file
+    const uint8_t* data_ = nullptr; //!< Start of the mapping
+    size_t length_ = 0; //!< Length of the mapping in bytes
+    const FeatureStoreHeader* header_ = nullptr; //!< Header at the start of the mapping
+    size_t recordSize_ = 0; //!< Bytes taken by one record
+    size_t groupLength_ = 0; //!< Number of values sharing one scale in UINT8 records
+};
+
+#endif //HOGFEATURESTORE_H
@@ -2,19 +2,220 @@
 #define HOGDESCRIPTOR_H
 
 #include <opencv2/opencv.hpp>
+#include "instrumentation.hpp"
+#include "quantization.hpp"
 #include <iostream>
 #include <numeric>
 #include <algorithm>
 #include <memory>
 #include <vector>
 #include <functional>
+#include <span>
+#include <chrono>
+#include <optional>
+#include <future>
+#include <coroutine>
+#include <exception>
+#include <new>
+#include <cstddef>
 #include <math.h>
 
+namespace hogkernels {
+struct KernelTable;
+}
+
+/**
+ * @brief Allocator returning storage aligned for SIMD loads and stores
+ * 
+ * @tparam T Element type
+ * @tparam Alignment Alignment of the storage in bytes
+ */
+template <typename T, std::size_t Alignment = 64>
+struct AlignedAllocator {
+    using value_type = T;
+
+    template <typename U>
+    struct rebind {
+        using other = AlignedAllocator<U, Alignment>;
+    };
+
+    AlignedAllocator() noexcept = default;
+    template <typename U>
+    AlignedAllocator(const AlignedAllocator<U, Alignment>&) noexcept {}
+
+    T* allocate(std::size_t n) {
+        return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t(Alignment)));
+    }
+    void deallocate(T* p, std::size_t) noexcept {
+        ::operator delete(p, std::align_val_t(Alignment));
+    }
+
+    template <typename U>
+    bool operator==(const AlignedAllocator<U, Alignment>&) const noexcept { return true; }
+    template <typename U>
+    bool operator!=(const AlignedAllocator<U, Alignment>&) const noexcept { return false; }
+};
+
+/**
+ * @brief Contiguous storage of the cell histograms laid out as cells_y x cells_x x binNumber
+ */
+class CellHistograms {
+public:
+    /**
+     * @brief Resize the storage and reset every histogram to zero
+     * 
+     * @param rows Number of cells in the vertical direction
+     * @param cols Number of cells in the horizontal direction
+     * @param bins Number of the bins in the histogram of each cell
+     */
+    void resize(int rows, int cols, int bins) {
+        rows_ = rows;
+        cols_ = cols;
+        bins_ = bins;
+        data_.assign(static_cast<size_t>(rows) * cols * bins, 0.0f);
+    }
+
+    /**
+     * @brief Resize the storage without resetting it, for callers that zero the histograms they fill
+     * 
+     * @param rows Number of cells in the vertical direction
+     * @param cols Number of cells in the horizontal direction
+     * @param bins Number of the bins in the histogram of each cell
+     */
+    void reshape(int rows, int cols, int bins) {
+        rows_ = rows;
+        cols_ = cols;
+        bins_ = bins;
+        data_.resize(static_cast<size_t>(rows) * cols * bins);
+    }
+
+    int rows() const { return rows_; } //!< Number of cells in the vertical direction
+    int cols() const { return cols_; } //!< Number of cells in the horizontal direction
+    int bins() const { return bins_; } //!< Number of the bins in each histogram
+    bool empty() const { return data_.empty(); } //!< True if no histograms are stored
+
+    /**
+     * @brief View of the histogram of the given cell
+     * 
+     * @param y Cell row position
+     * @param x Cell column position
+     */
+    std::span<float> operator()(int y, int x) {
+        return {data_.data() + (static_cast<size_t>(y) * cols_ + x) * bins_, static_cast<size_t>(bins_)};
+    }
+    std::span<const float> operator()(int y, int x) const {
+        return {data_.data() + (static_cast<size_t>(y) * cols_ + x) * bins_, static_cast<size_t>(bins_)};
+    }
+
+    /**
+     * @brief View of all the histograms in the given cell row
+     * 
+     * @param y Cell row position
+     */
+    std::span<float> row(int y) {
+        return {data_.data() + static_cast<size_t>(y) * cols_ * bins_, static_cast<size_t>(cols_) * bins_};
+    }
+    std::span<const float> row(int y) const {
+        return {data_.data() + static_cast<size_t>(y) * cols_ * bins_, static_cast<size_t>(cols_) * bins_};
+    }
+
+    float* data() { return data_.data(); } //!< Pointer to the first bin of the first cell
+    const float* data() const { return data_.data(); } //!< Pointer to the first bin of the first cell
+    size_t size() const { return data_.size(); } //!< Total number of stored bins
+    size_t capacity() const { return data_.capacity(); } //!< Number of bins the storage holds without reallocation
+
+private:
+    int rows_ = 0; //!< Number of cells in the vertical direction
+    int cols_ = 0; //!< Number of cells in the horizontal direction
+    int bins_ = 0; //!< Number of the bins in each histogram
+    std::vector<float, AlignedAllocator<float>> data_; //!< Contiguous histogram values
+};
+
+/**
+ * @brief One scale of the HOG feature pyramid
+ */
+struct HOGPyramidLevel {
+    double scale = 1.0; //!< Scale of the level relative to the input image
+    bool approximated = false; //!< True if resampled from the nearest octave instead of computed exactly
+    CellHistograms cellHistograms; //!< Cell histograms of the level
+    std::vector<float> featureVector; //!< HOG feature vector of the level
+};
+
+class FeatureCache;
+
+/**
+ * @brief Linear classifier of detection windows, e.g. a linear SVM
+ */
+struct LinearClassifier {
+    std::vector<float> weights; //!< One weight per value of the window descriptor, in the layout of computeWindows
+    float bias = 0.0f; //!< Added to the dot product of every window
+};
+
+/**
+ * @brief Parameters of a HOGDescriptor
+ */
+struct HOGParameters {
+    int blockSize; //!< Block size of the sliding window
+    int cellSize; //!< Size of the cell in pixels
+    int stride; //!< Sliding window stride in pixels
+    int binNumber; //!< Number of the bins in the histogram of each cell
+    int gradType; //!< Type of the gradient calculation (unsigned or signed)
+
+    bool operator==(const HOGParameters&) const = default;
+};
+
+/**
+ * @brief Buffers of a HOGDescriptor reused by every computeHOG call
+ * 
+ * Buffers only grow, so once they are sized for a resolution and parameter set
+ * the following images of that size are computed without heap allocations.
+ */
+struct HOGWorkspace {
+    /**
+     * @brief Row buffers of one band of cell rows, binned by one thread at a time
+     */
+    struct RowBuffers {
+        std::vector<float> rows; //!< Three input rows with their horizontal neighbours
+        std::vector<float> magnitude; //!< Gradient magnitude of each pixel of the row
+        std::vector<int> bin; //!< Orientation bin of each pixel of the row
+        std::vector<int16_t> fixedRows; //!< Input rows of the integer pipeline
+        std::vector<uint16_t> fixedMagnitude; //!< Fixed-point gradient magnitudes of the integer pipeline
+        std::vector<uint8_t> fixedBin; //!< Orientation bins of the integer pipeline
+        std::vector<uint32_t> accumulator; //!< Fixed-point histograms of the current cell row
+        std::vector<double> rowSum; //!< Running bin sums of the current integral image row
+    };
+
+    std::vector<RowBuffers> bands; //!< Row buffers of each band, the serial passes use the first one
+    CellHistograms cellHistograms; //!< Matrix of cell histograms
+    std::vector<double> integralHistogram; //!< (rows + 1) x (cols + 1) x binNumber integral images of the bins
+    std::vector<float> featureVector; //!< Final vector of features
+    cv::Mat converted; //!< Float copy of the input for the depths the kernels cannot read
+    cv::Mat gray; //!< Float input of the on-demand gradient images
+    cv::Mat gradientX; //!< Horizontal gradient of the on-demand gradient images
+    cv::Mat gradientY; //!< Vertical gradient of the on-demand gradient images
+    cv::Mat previousFrame; //!< Copy of the last frame of updateHOG, compared with the next one
+    cv::Mat source; //!< Copy of the last input image of computeHOG for the queries computed on demand
+    std::vector<uint8_t> dirtyCells; //!< Cells to recompute in updateHOG or to bin in computeAt, one flag per cell
+    std::vector<float> cellEnergy; //!< Energy of each cell histogram for the block normalization, reused by every block holding the cell
+    std::vector<float> blockNorms; //!< Inverse norm of every 2 x 2 block of cells of the compact layout
+};
+
 /**
  * @brief Class for calculating the HOG (Histogram of oriented gradients) features.
  */
 class HOGDescriptor {
 public:
+    /**
+     * @brief Block normalization scheme, chosen at construction
+     */
+    enum class NormType {
+        L2_CLIPPED, //!< v / sqrt(|v|^2 + eps) clipped at 0.5, without renormalization (default, the original scheme)
+        L1, //!< v / (|v|_1 + eps)
+        L1_SQRT, //!< sqrt(v / (|v|_1 + eps))
+        L2, //!< v / sqrt(|v|^2 + eps)
+        L2_HYS //!< L2, clipping at 0.2, then L2 again over the clipped values (Dalal and Triggs)
+    };
+
     /**
      * @brief Default constructor for the HOGDescriptor class.
      */
@@ -27,9 +228,11 @@ public:
      * @param stride Sliding window stride
      * @param binNumber Number of the bins in the histogram for each cell
      * @param gradType Type of the gradient calculation (unsigned or signed)
+     * @param normType Block normalization scheme
      */
     HOGDescriptor(const size_t blockSize, const size_t cellSize, 
-        const size_t stride, const size_t binNumber, const size_t gradType);
+        const size_t stride, const size_t binNumber, const size_t gradType,
+        const NormType normType = NormType::L2_CLIPPED);
     /**
      * @brief Construct a new HOGDescriptor object
      * 
@@ -62,12 +265,323 @@ public:
 public:
     static const size_t GRADIENT_SIGNED = 360; //!< 360 degree spread of histogram channels
     static const size_t GRADIENT_UNSIGNED = 180; //!< 180 degree spread of histogram channels
+
+    /**
+     * @brief Histogram backend used to bin the gradients
+     */
+    enum class HistogramBackend {
+        CELL_GRID, //!< Bin every cell of the fixed cell grid directly
+        INTEGRAL //!< Per-bin integral images, histogram of any rectangle in constant time
+    };
+
+    /**
+     * @brief Select the histogram backend for the next computeHOG call
+     * 
+     * The integral backend is also used automatically whenever the stride is not
+     * a multiple of the cell size, so that blocks are placed at their exact pixel offsets.
+     * 
+     * @param backend Histogram backend
+     */
+    void setHistogramBackend(HistogramBackend backend);
+
+    /**
+     * @brief Layout of the feature vector
+     */
+    enum class FeatureLayout {
+        BLOCKS, //!< Normalized blocks of the block grid, every cell copied into each block holding it (default)
+        COMPACT //!< Felzenszwalb cell features, binNumber + binNumber / 2 + 4 values per cell (31 for 18 signed bins)
+    };
+
+    /**
+     * @brief Select the layout of the feature vector for the next computations
+     * 
+     * The compact layout is computed in one pass over the signed cell histograms, as in the
+     * deformable part models of Felzenszwalb et al. Each cell is normalized by the four 2 x 2 blocks
+     * of cells around it. Its features are the signed bins, then the unsigned bins (opposite signed bins
+     * summed), each clipped at 0.2 under every block and summed over the four blocks with weight 0.5,
+     * then four texture energies, the clipped signed bins under each block summed with weight 1/sqrt(binNumber).
+     * The border cells lack blocks on one side, so the vector holds (cells_y - 2) x (cells_x - 2) cells
+     * row by row, for example for linear filters over the cell grid. Block size and stride do not apply.
+     * computeWindows and computeAt need the block layout, updateHOG recomputes the whole frame.
+     * 
+     * @param layout Feature layout, COMPACT needs signed gradients (gradType 360) and an even binNumber
+     */
+    void setFeatureLayout(FeatureLayout layout);
+
+    /**
+     * @brief Layout of the feature vector
+     */
+    FeatureLayout getFeatureLayout() const;
+
+    /**
+     * @brief Enable the integer pipeline for 8-bit images
+     * 
+     * Gradients stay in 16-bit integers, the orientation bin comes from a (gx, gy) lookup table
+     * and magnitudes are accumulated in 1/64 of a gray level, histograms become float once per cell.
+     * Compared with the float pipeline every pixel magnitude is off by at most 1/(128 * 255),
+     * so a cell bin is off by at most cellSize^2 / 32640. Bins are decided with the same
+     * orientation polynomial, only gradients within float rounding of a bin edge can land
+     * in the neighbouring bin. Used by the cell grid backend, other depths keep the float pipeline.
+     * 
+     * @param enabled True to use the integer pipeline for CV_8U images
+     */
+    void setIntegerPipeline(bool enabled);
+
+    /**
+     * @brief Look up the results of computeHOG in an on-disk cache before computing them
+     * 
+     * computeHOG hashes the pixels of the image with the parameters, the norm type, the feature layout,
+     * the histogram backend and the integer pipeline setting. A hit copies the cell histograms and the
+     * feature vector out of the mapped entry, a miss computes them and writes a new entry.
+     * The input checks still run on every call. The cache is shared by the descriptors of
+     * computeHOGBatch and by the copies of cloneSettings.
+     * 
+     * @param cache Feature cache, empty to compute every image
+     */
+    void setFeatureCache(std::shared_ptr<FeatureCache> cache);
+
+    /**
+     * @brief Enable the check that the channels of multi-channel images are equal
+     * 
+     * Single-channel images are never checked. Disable it when the caller already
+     * guarantees grayscale input, to save one pass over the pixels.
+     * 
+     * @param enabled True to check multi-channel images (default)
+     */
+    void setGrayscaleCheck(bool enabled);
+
+    /**
+     * @brief Set the callback receiving the stats of every recorded call
+     * 
+     * computeHOG, updateHOG, computePyramid, computeWindows, computeAt, scoreWindows, computeHOGBatch, getHOGFeatureVector, saveVectorData
+     * and visualizeHOG are recorded, calls made by another recorded call add to the outer one. computeHOGBatch adds
+     * the stages and counters of the descriptors of its tasks, so its stage times are summed over the threads.
+     * The callback runs on the calling thread. Never called unless the library is built with HOG_ENABLE_INSTRUMENTATION=1.
+     * 
+     * @param callback Stats callback, empty to remove it
+     */
+    void setStatsCallback(HOGStatsCallback callback);
+
+    /**
+     * @brief Stats of the last recorded call, all zero without HOG_ENABLE_INSTRUMENTATION
+     */
+    const HOGStats& getStats() const;
     /**
      * @brief Method for computing HOG features
      * 
-     * @param image: Input image
+     * CV_8U, CV_16U and CV_32F images are read in place, also non-continuous ROI views,
+     * without copies or conversion passes. Pixel values are taken in [0, 1]:
+     * 8-bit scaled by 1/255, 16-bit by 1/65535, floats as they are.
+     * Multi-channel images must be grayscale (equal channels), only the first channel is used.
+     * The descriptor keeps a copy of the image for visualizeHOG and the histogram queries at
+     * pixel offsets, so the caller may reuse or release its buffer once the call returns.
+     * 
+     * @param image: Input image, left unchanged
+     */
+    void computeHOG(const cv::Mat& image);
+
+    /**
+     * @brief Awaitable of computeHOGAwaitable, co_await gives the view of the feature vector
      */
-    void computeHOG(cv::Mat& image);
+    class ComputeAwaitable {
+    public:
+        bool await_ready() const noexcept { return false; } //!< The computation always runs on the pool
+
+        /**
+         * @brief Queue the computation, the coroutine is resumed by the pool worker that ran it
+         * 
+         * @param continuation Suspended coroutine
+         */
+        void await_suspend(std::coroutine_handle<> continuation);
+
+        /**
+         * @brief View of the feature vector, rethrows the exception of the computation
+         */
+        std::span<const float> await_resume();
+
+    private:
+        friend class HOGDescriptor;
+        ComputeAwaitable(HOGDescriptor& hog, cv::Mat image) : hog_(hog), image_(std::move(image)) {}
+
+        HOGDescriptor& hog_; //!< Descriptor computing the features
+        cv::Mat image_; //!< Input image, shares the pixels of the caller
+        std::exception_ptr error_; //!< Exception thrown by the computation
+    };
+
+    /**
+     * @brief Method for computing HOG features on the library thread pool
+     * 
+     * Runs computeHOG on ThreadPool::global() and returns at once, so event loops and pipelines
+     * can decode the next image or upload the previous results meanwhile. The image header is copied
+     * and shares the pixels, which must stay unchanged until the future is ready. The descriptor runs
+     * one computation at a time: it must outlive the call and must not be used until the future is
+     * ready, computations in flight together need one descriptor each (see cloneSettings).
+     * Exceptions of computeHOG are stored in the future. The stats callback runs on the pool worker.
+     * 
+     * @param image Input image, as for computeHOG
+     * @return Future of the view of the feature vector, valid until the next compute call
+     */
+    std::future<std::span<const float>> computeHOGAsync(cv::Mat image);
+
+    /**
+     * @brief Coroutine variant of computeHOGAsync
+     * 
+     * co_await suspends the coroutine until the features are computed on the thread pool,
+     * it continues on the pool worker that computed them, without blocking any thread.
+     * The same rules as for computeHOGAsync apply to the image and the descriptor.
+     * 
+     * @param image Input image, as for computeHOG
+     * @return Awaitable giving the view of the feature vector, valid until the next compute call
+     */
+    ComputeAwaitable computeHOGAwaitable(cv::Mat image);
+
+    /**
+     * @brief Method for updating the HOG features of the next frame of a video where only some regions changed
+     * 
+     * Gradients and histograms are recomputed only for the cells within one pixel of a dirty rectangle
+     * (the reach of the central differences), and only the blocks holding such a cell are normalized again.
+     * The rest of the feature vector is kept, the result is identical to computeHOG on the frame.
+     * Falls back to computeHOG if the frame size or type differs from the last computed image,
+     * or the integral backend is in use.
+     * 
+     * @param frame Input frame
+     * @param dirtyRects Pixel rectangles that may differ from the last computed image
+     */
+    void updateHOG(const cv::Mat& frame, std::span<const cv::Rect> dirtyRects);
+
+    /**
+     * @brief Method for updating the HOG features of the next frame of a video, finding the changes itself
+     * 
+     * The frame is compared pixel by pixel with a copy of the previous updateHOG frame,
+     * then updated like updateHOG(frame, dirtyRects). The first call computes the whole frame.
+     * 
+     * @param frame Input frame
+     */
+    void updateHOG(const cv::Mat& frame);
+
+    /**
+     * @brief Size the internal buffers for images of the given size and type
+     * 
+     * Runs one pass over a blank image, so that the first real frame already finds
+     * every buffer in place. The computed results are discarded.
+     * 
+     * @param imageSize Image size in pixels
+     * @param type OpenCV type of the images that will be passed to computeHOG
+     */
+    void reserve(const cv::Size& imageSize, int type = CV_8UC1);
+
+    /**
+     * @brief Method for computing the HOG feature vectors of many images in parallel
+     * 
+     * Images are scheduled over the shared work-stealing pool, every task works with its own
+     * copy of the descriptor settings, so the results stored in this object are left untouched.
+     * 
+     * @param images Input images, all of them must give feature vectors of the same length
+     * @return Matrix with the feature vector of each image in its row
+     */
+    cv::Mat computeHOGBatch(std::span<const cv::Mat> images);
+
+    /**
+     * @brief Length of the HOG feature vector for the given image size
+     * 
+     * @param imageSize Image size in pixels
+     * @return Number of values in the feature vector
+     */
+    size_t getDescriptorSize(const cv::Size& imageSize) const;
+
+    /**
+     * @brief Parameters the descriptor was constructed with
+     */
+    HOGParameters getParameters() const;
+
+    /**
+     * @brief Block normalization scheme the descriptor was constructed with
+     */
+    NormType getNormType() const;
+
+    /**
+     * @brief Method for computing the HOG descriptors of every detection window position
+     * 
+     * Gradients, cell histograms and block normalizations are computed once for the whole image
+     * and shared by all the overlapping windows.
+     * 
+     * @param image Input image
+     * @param windowSize Detection window size in pixels, (windowSize - blockSize) must be a multiple of the stride
+     * @param windowStride Window stride in pixels, must be a multiple of the stride
+     * @param locations Output top-left pixel of each window
+     * @return Matrix with the descriptor of each window in its row
+     */
+    cv::Mat computeWindows(const cv::Mat& image, const cv::Size& windowSize, const cv::Size& windowStride, std::vector<cv::Point>& locations);
+
+    /**
+     * @brief Method for scoring detection windows with a linear classifier
+     * 
+     * Scores the windows of computeWindows without building their descriptors or the image vector:
+     * every block of a window is gathered and normalized into a block-sized buffer and its dot product
+     * with the block weights is added to the score at once. With a threshold the blocks are visited
+     * in decreasing order of the largest contribution their weights can give to a normalized block
+     * (|w+|_2 under L2 schemes, max(w) under L1), and a window is dropped as soon as its partial score
+     * plus the bound of the blocks left is below the threshold. The cascade is exact: a dropped window
+     * scores below the threshold, the others get the same score as without threshold.
+     * Only the cell histograms are kept, the feature vector getters need computeHOG.
+     * 
+     * @param image Input image
+     * @param classifier Weights of the window descriptor and bias
+     * @param windowSize Detection window size in pixels, (windowSize - blockSize) must be a multiple of the stride
+     * @param windowStride Window stride in pixels, must be a multiple of the stride
+     * @param locations Output top-left pixel of each window
+     * @param threshold Score the windows must reach, none to score every window completely
+     * @return Score of each window, -infinity for the windows dropped by the cascade
+     */
+    std::vector<float> scoreWindows(const cv::Mat& image, const LinearClassifier& classifier, const cv::Size& windowSize,
+                                    const cv::Size& windowStride, std::vector<cv::Point>& locations,
+                                    std::optional<float> threshold = std::nullopt);
+
+    /**
+     * @brief Method for computing HOG descriptors only at the given window locations
+     * 
+     * Only the cells covered by the windows are binned, each of them once even if windows overlap,
+     * the rest of the image is never read (apart from the grayscale check of multi-channel images).
+     * Locations are rounded down to the cell grid, so a window at a multiple of the stride gives
+     * the same descriptor as the matching row of computeWindows. The cell grid backend is always used.
+     * The results of previous computations are discarded.
+     * 
+     * @param image Input image
+     * @param locations Top-left pixel of each window, the windows must lie inside the image
+     * @param windowSize Window size in pixels, (windowSize - blockSize) must be a multiple of the stride
+     * @return Matrix with the descriptor of each window in its row, in the order of the locations
+     */
+    cv::Mat computeAt(const cv::Mat& image, std::span<const cv::Point> locations, const cv::Size& windowSize);
+
+    /**
+     * @brief Method for computing HOG descriptors only inside the given regions
+     * 
+     * Same as computeAt with the top-left corners of the regions as locations.
+     * 
+     * @param image Input image
+     * @param regions Pixel regions, all of the same size
+     * @return Matrix with the descriptor of each region in its row, in the order of the regions
+     */
+    cv::Mat computeAt(const cv::Mat& image, std::span<const cv::Rect> regions);
+
+    /**
+     * @brief Method for computing HOG features over an image pyramid
+     * 
+     * Scales go down from 1 by a factor of 2^(-1/scalesPerOctave) until a block no longer fits.
+     * Gradients and cell histograms are computed exactly only at the octaves (1, 1/2, 1/4, ...).
+     * The scales in between resample the cell histograms of the octave above and correct them
+     * with the power law (ratio)^(-lambda), as in fast feature pyramids.
+     * After the call the descriptor holds the results of the full-size image.
+     * 
+     * @param image Input image
+     * @param scalesPerOctave Number of scales in each octave, 1 computes the octaves only
+     * @param lambda Power law exponent of the gradient histogram channels
+     * @return Pyramid levels from the largest scale to the smallest
+     */
+    std::vector<HOGPyramidLevel> computePyramid(const cv::Mat& image, int scalesPerOctave, double lambda = PYRAMID_LAMBDA);
+
+    static constexpr double PYRAMID_LAMBDA = 0.101; //!< Power law exponent of the gradient histograms for downsampling
+    static const size_t PARALLEL_MIN_PIXELS = 1 << 19; //!< Images from this size on are binned and normalized on the thread pool
 
     /**
      * @brief Method for getting the HOG feature vector
@@ -76,70 +590,271 @@ public:
      */
     std::vector<float> getHOGFeatureVector();
 
+    /**
+     * @brief Method for getting the HOG feature vector in a compact value type
+     * 
+     * FLOAT16 halves the size, every value is off by at most 2^-12 (2^-13 with the default norm).
+     * UINT8 quarters it plus one float scale per block, every value is off by at most
+     * 1/510 of the largest value of its block. See quant for the exact bounds.
+     * 
+     * @param type FLOAT16 or UINT8
+     * @return Quantized vector of features, UINT8 groups are the blocks of the descriptor (the cells of the compact layout)
+     */
+    QuantizedVector getHOGFeatureVector(HOGValueType type);
+
+    /**
+     * @brief View of the HOG feature vector without copying it
+     * 
+     * Valid until the next compute call.
+     * 
+     * @return View of the features
+     */
+    std::span<const float> getHOGFeatureView() const;
+
+    /**
+     * @brief Cell histograms of the last computed image
+     * 
+     * @return Histograms laid out as cells_y x cells_x x binNumber
+     */
+    const CellHistograms& getCellHistograms() const;
+
     /**
      * @brief Get the Cell Histogram object
      * 
      * @param y Cell row position
      * @param x Cell column position
-     * @return Histogram vector for the cell
+     * @return View of the histogram of the cell
      */
-    std::vector<float> getCellHistogram(int y, int x);
+    std::span<const float> getCellHistogram(int y, int x);
     /**
      * @brief Get the Block Histogram object
      * 
      * @param y first cell row position
      * @param x first cell column position
-     * @return Block histogram matrix
+     * @return Views of the histograms of the cells within the block
+     */
+    std::vector<std::span<const float>> getBlockHistogram(int y, int x);
+    /**
+     * @brief Get the histogram of the cell at an arbitrary pixel offset
+     * 
+     * Uses the integral histograms, which are built on first use if the cell grid backend is selected.
+     * 
+     * @param offset Top-left pixel of the cell
+     * @return Histogram vector for the cell
      */
-    std::vector<std::vector<float>> getBlockHistogram(int y, int x);
+    std::vector<float> getCellHistogram(const cv::Point& offset);
+    /**
+     * @brief Get the histograms of the block at an arbitrary pixel offset
+     * 
+     * @param offset Top-left pixel of the block
+     * @return Concatenated histograms of the cells within the block (not normalized)
+     */
+    std::vector<float> getBlockHistogram(const cv::Point& offset);
     /**
      * @brief Save hog vector in a file
      * 
+     * Writes the values as text, FeatureStoreWriter keeps many vectors in one binary file.
+     * 
      * @param executablePath Path where file will be saved
      * @param vectorName Output vector name 
      */
     void saveVectorData(const std::string& executablePath, const std::string& vectorName);
 
 private:
+    friend class HOGBenchmark; //!< Per-stage timings of the hog_bench target
+    class CallScope; //!< Records the stats of one public call, defined in hogdescriptor.cpp
+    class StageScope; //!< Times one stage of the current call, defined in hogdescriptor.cpp
+
+    /**
+     * @brief Visit the byte size of every workspace buffer, always in the same order
+     * 
+     * @param visit Called with the size of each buffer
+     */
+    template <typename Visitor>
+    void forEachBuffer(Visitor visit) const;
+
     /**
-     * @brief Function to compute each pixel's gradient magnitude and orientation
+     * @brief New descriptor with the same parameters and settings, without any computed data
+     * 
+     * The stats callback is not copied, computeHOGBatch adds the stats of its copies to its own call.
+     */
+    HOGDescriptor cloneSettings() const;
+
+    /**
+     * @brief Function to compute each pixel's gradient magnitude and orientation images
+     * 
+     * Not needed by the descriptor itself, the cell histograms are binned by the fused kernels.
      * 
      * @param image: Input image
      */
-    void computeGradientFeatures(cv::Mat& image);
+    void computeGradientFeatures(const cv::Mat& image);
 
     /**
      * @brief Compute the HOG feature vectors for each cell in the image.
      * 
-     * @param gradient: Gradient matrix
-     * @param orientation:  Orientation matrix
-     * @param cell_histograms:  Output vector of HOG feature vectors for each cell
-     * @return Matrix of histograms
+     * @param image: Input image
+     * @param cell_histograms:  Output storage of the histograms for each cell
+     */
+    void computeCellHistograms(const cv::Mat& image, CellHistograms& cell_histograms);
+
+    /**
+     * @brief Bin the gradients of a rectangle of cells in one fused pass
+     * 
+     * Central differences, magnitude and orientation bin are computed row by row
+     * and added straight into the histograms, without full-image intermediate matrices.
+     * 
+     * @param image Input image
+     * @param cells Rectangle of cells to bin, in cell units
+     * @param cell_histograms Histograms of the cells, must be zeroed before the call
+     * @param buffers Row buffers of the band
+     */
+    void binCells(const cv::Mat& image, const cv::Rect& cells, CellHistograms& cell_histograms, HOGWorkspace::RowBuffers& buffers);
+
+    /**
+     * @brief Integer version of binCells for 8-bit images
+     * 
+     * @param image Input CV_8U image
+     * @param cells Rectangle of cells to bin, in cell units
+     * @param cell_histograms Histograms of the cells, must be zeroed before the call
+     * @param buffers Row buffers of the band
      */
-    std::vector<std::vector<std::vector<float>>> computeCellHistograms(cv::Mat magnitude, cv::Mat orientation, std::vector<std::vector<std::vector<float>>>& cell_histograms);
+    void binCellsFixed(const cv::Mat& image, const cv::Rect& cells, CellHistograms& cell_histograms, HOGWorkspace::RowBuffers& buffers);
 
     /**
-     * @brief Method to compute the histogram for the given cell
+     * @brief Build per-bin integral images and fill the cell histograms from them
      * 
-     * @param cellMagnitude Cell magnitude matrix
-     * @param cellOrientation Cell orientation matrix
+     * @param image: Input image
+     * @param cell_histograms:  Output storage of the histograms for each cell
      */
-    std::vector<float> cellHistogram(const cv::Mat& cellMagnitude, const cv::Mat& cellOrientation);
+    void computeIntegralHistograms(const cv::Mat& image, CellHistograms& cell_histograms);
+
+    /**
+     * @brief Build the per-bin integral images of the gradient magnitudes
+     * 
+     * @param image: Input image
+     */
+    void buildIntegralImages(const cv::Mat& image);
+
+    /**
+     * @brief Histogram of an arbitrary pixel rectangle from the integral images
+     * 
+     * @param rect Pixel rectangle inside the image
+     * @param histogram Output histogram
+     */
+    void rectHistogram(const cv::Rect& rect, std::span<float> histogram) const;
+
+    /**
+     * @brief Resample the cell histograms of an octave to an intermediate scale
+     * 
+     * @param octave Cell histograms computed exactly at the octave
+     * @param level Output cell histograms of the intermediate scale
+     * @param rows Number of cells in the vertical direction at the intermediate scale
+     * @param cols Number of cells in the horizontal direction at the intermediate scale
+     * @param ratio Intermediate scale relative to the octave, in (0.5, 1)
+     * @param lambda Power law exponent of the gradient histograms
+     */
+    void resampleCellHistograms(const CellHistograms& octave, CellHistograms& level, int rows, int cols, double ratio, double lambda);
 
     /**
      * @brief Function to normalize the HOG feature vectors for each block of cells in the image
      * 
-     * @param block: Vector of histograms representing the cells within a block
+     * @param block: Concatenated histograms of the cells within a block
+     */
+    void normalizeBlockHistogram(std::span<float> block_histogram);
+
+    /**
+     * @brief Normalize a block whose energy is already known
+     * 
+     * @param block_histogram Concatenated histograms of the cells within a block
+     * @param energy Sum of the workspace_.cellEnergy values of the cells of the block
+     */
+    void normalizeBlockHistogram(std::span<float> block_histogram, float energy);
+
+    /**
+     * @brief Compute workspace_.cellEnergy for every cell of a histogram grid
+     * 
+     * @param cell_histograms Matrix of histograms
      */
-    void normalizeBlockHistogram(std::vector<float>& block_histogram);
+    void computeCellEnergy(const CellHistograms& cell_histograms);
+
+    /**
+     * @brief Copy and normalize the histograms of one block
+     * 
+     * @param cell_histograms Matrix of histograms
+     * @param y Block row position
+     * @param x Block column position
+     * @param block Output block of the final vector
+     */
+    void fillBlock(const CellHistograms& cell_histograms, int y, int x, std::span<float> block);
+
+    /**
+     * @brief Check that a detection window consists of whole blocks
+     * 
+     * @param windowSize Window size in pixels
+     */
+    void checkWindowSize(const cv::Size& windowSize) const;
+
+    /**
+     * @brief Check that a window stride moves the windows by whole blocks
+     * 
+     * @param windowStride Window stride in pixels
+     */
+    void checkWindowStride(const cv::Size& windowStride) const;
+
+    /**
+     * @brief Compute the cell histograms of the source image with the selected backend
+     */
+    void binSourceImage();
+
+    /**
+     * @brief Feature cache key of an image computed with the current settings
+     * 
+     * @param image Input image
+     */
+    uint64_t cacheKey(const cv::Mat& image) const;
+
+    /**
+     * @brief Validate the input image and make it the source of the following computations
+     * 
+     * @param image Input image
+     */
+    void setSourceImage(const cv::Mat& image);
+
+    /**
+     * @brief Make the source image a copy owned by the workspace
+     * 
+     * The caller may reuse or release its buffer once a computation returns, visualizeHOG,
+     * the histogram queries at pixel offsets and updateHOG read the copy instead.
+     * 
+     * @param kept Copy of the image already held by the workspace, e.g. the previous frame of updateHOG, or empty
+     */
+    void keepSourceImage(const cv::Mat& kept = cv::Mat());
+
+    /**
+     * @brief Recompute the cells flagged in workspace_.dirtyCells and the blocks holding them
+     */
+    void updateDirtyCells();
 
     /**
      * @brief Method to calculate the HOG feature vector
      * 
      * @param cell_histograms Matrix of histograms
-     * @return Final vector
+     * @return View of the final vector
      */
-    const std::vector<float> calculateHOGVector(const std::vector<std::vector<std::vector<float>>>& cell_histograms);
+    std::span<const float> calculateHOGVector(const CellHistograms& cell_histograms);
+
+    /**
+     * @brief Method to calculate the feature vector of the compact layout
+     * 
+     * @param cell_histograms Matrix of signed histograms
+     * @return View of the final vector
+     */
+    std::span<const float> calculateCompactVector(const CellHistograms& cell_histograms);
+
+    /**
+     * @brief Number of values of each feature group: a block, or a cell of the compact layout
+     */
+    size_t featureGroupLength() const;
 
 private:
     int blockSize_; //!< Block size of the sliding window
@@ -148,14 +863,33 @@ private:
     int binWidth_; //!< Width of the bins in the histogram of each cell
     int stride_; //!< Sliding window stride in pixels
     int gradType_; //!< Type of the gradient calculation (unsigned or signed)
+    NormType normType_ = NormType::L2_CLIPPED; //!< Block normalization scheme
 
     bool hogFlag_ = false; //!< Flag to check if the HOG feature vector has been computed
+    bool frameKept_ = false; //!< Flag to check if workspace_.previousFrame holds the last computed image
+
+    cv::Mat sourceImage_; //!< Last input image, owned by the workspace once the computation returns, for the queries computed on demand
+    cv::Mat imageMagnitude_; //!< Magnitude of the gradients, built on demand
+    cv::Mat imageOrientation_; //!< Orientation of the gradients, built on demand
+    bool gradientFlag_ = false; //!< Flag to check if the gradient images belong to the current image
+
+    HistogramBackend histogramBackend_ = HistogramBackend::CELL_GRID; //!< Selected histogram backend
+    FeatureLayout featureLayout_ = FeatureLayout::BLOCKS; //!< Layout of the feature vector
+    std::shared_ptr<FeatureCache> featureCache_; //!< Cache of computeHOG results, none by default
+    bool integralFlag_ = false; //!< Flag to check if the integral histograms are built for the current image
+    bool integerPipeline_ = false; //!< Flag to bin 8-bit images with the integer pipeline
+    bool grayscaleCheck_ = true; //!< Flag to check that the channels of the input image are equal
+    std::vector<uint8_t> binLookup_; //!< (gx, gy) to orientation bin table of the integer pipeline
+    const hogkernels::KernelTable* kernels_ = nullptr; //!< Kernels specialized for the parameters, chosen at construction
 
-    cv::Mat imageMagnitude_; //!< Magnitude of the gradients
-    cv::Mat imageOrientation_; //!< Orientation of the gradients
+    HOGWorkspace workspace_; //!< Histograms, final vector and scratch buffers reused between calls
 
-    std::vector<std::vector<std::vector<float>>> cellHistograms_; //!< Matrix of cell histograms
-    std::vector<float> hogFeatureVector_; //!< Final vector of features
+    HOGStats stats_; //!< Stats of the last recorded call
+    HOGStatsCallback statsCallback_; //!< Receiver of the stats of every recorded call
+    int callDepth_ = 0; //!< Number of recorded calls in progress, only the outermost one reports
+    int activeStage_ = -1; //!< Stage being timed, -1 outside of every stage
+    std::chrono::steady_clock::time_point stageStart_; //!< Start of the current timing of the active stage
+    std::vector<size_t> bufferSizes_; //!< Workspace buffer sizes at the start of the call
 };
 
 #endif //HOGDESCRIPTOR_H
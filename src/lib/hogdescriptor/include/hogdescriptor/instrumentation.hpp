@@ -0,0 +1,79 @@
+#ifndef HOGDESCRIPTOR_INSTRUMENTATION_H
+#define HOGDESCRIPTOR_INSTRUMENTATION_H
+
+#include <array>
+#include <cstdint>
+#include <functional>
+
+// Set to 1 by the INSTRUMENTATION build flag, 0 compiles every timer and counter away
+#ifndef HOG_ENABLE_INSTRUMENTATION
+#define HOG_ENABLE_INSTRUMENTATION 0
+#endif
+
+/**
+ * @brief Timings and counters of one public HOGDescriptor call
+ *
+ * Recorded only when the library is built with HOG_ENABLE_INSTRUMENTATION=1,
+ * otherwise every field stays zero and no clock is read.
+ */
+struct HOGStats {
+    /**
+     * @brief Pipeline stages, each timed without the stages nested in it
+     */
+    enum Stage {
+        VALIDATION, //!< Input checks, grayscale check, conversion of other depths and the change detection of updateHOG
+        GRADIENTS, //!< Full-image gradient images (Sobel and cartToPolar), built on demand only
+        BINNING, //!< Fused gradient and cell binning pass, or the integral images of the integral backend
+        NORMALIZATION, //!< Block gathering and normalization into the final vector
+        OUTPUT, //!< Copies and serialization of the final vector
+        STAGE_COUNT
+    };
+
+    static constexpr bool enabled = HOG_ENABLE_INSTRUMENTATION; //!< True if the library records stats
+
+    const char* call = ""; //!< Name of the public method
+    std::array<double, STAGE_COUNT> stageMs{}; //!< Wall time of each stage in milliseconds
+    double totalMs = 0; //!< Wall time of the whole call in milliseconds
+    uint64_t bytesRead = 0; //!< Bytes of pixels, histograms and vectors read
+    uint64_t bytesWritten = 0; //!< Bytes of histograms, vectors and files written
+    uint64_t allocations = 0; //!< Workspace buffers allocated or grown during the call
+    uint64_t allocatedBytes = 0; //!< Growth of the workspace buffers in bytes
+    uint64_t cells = 0; //!< Cell histograms binned
+    uint64_t blocks = 0; //!< Blocks normalized
+
+    /**
+     * @brief Add the stage times and counters of another call, e.g. one made for this call on another thread
+     *
+     * The call name and the total time are kept, so stage times may add up to more than the wall time.
+     *
+     * @param other Stats of the other call
+     */
+    void add(const HOGStats& other) {
+        for (int stage = 0; stage < STAGE_COUNT; stage++) {
+            stageMs[stage] += other.stageMs[stage];
+        }
+        bytesRead += other.bytesRead;
+        bytesWritten += other.bytesWritten;
+        allocations += other.allocations;
+        allocatedBytes += other.allocatedBytes;
+        cells += other.cells;
+        blocks += other.blocks;
+    }
+
+    /**
+     * @brief Lower-case name of a stage
+     *
+     * @param stage Pipeline stage
+     */
+    static const char* stageName(Stage stage) {
+        static const char* const names[STAGE_COUNT] = {"validation", "gradients", "binning", "normalization", "output"};
+        return names[stage];
+    }
+};
+
+/**
+ * @brief Callback receiving the stats at the end of every recorded call, must not throw
+ */
+using HOGStatsCallback = std::function<void(const HOGStats&)>;
+
+#endif //HOGDESCRIPTOR_INSTRUMENTATION_H
@@ -0,0 +1,40 @@
+#ifndef HOGMAPPEDFILE_H
+#define HOGMAPPEDFILE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/**
+ * @brief Read-only mapping of a whole file into memory
+ */
+class MappedFile {
+public:
+    /**
+     * @brief Map a file
+     *
+     * @param path Path of the file
+     * @param kind Name of the kind of file for the error messages, e.g. "feature store"
+     */
+    MappedFile(const std::string& path, const char* kind);
+    /**
+     * @brief Unmap the file
+     */
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const uint8_t* data() const { return data_; } //!< Start of the mapping
+    size_t size() const { return length_; } //!< Length of the mapping in bytes
+
+private:
+    const uint8_t* data_ = nullptr; //!< Start of the mapping
+    size_t length_ = 0; //!< Length of the mapping in bytes
+#ifdef _WIN32
+    void* file_ = nullptr; //!< File handle
+    void* mapping_ = nullptr; //!< File mapping handle
+#endif
+};
+
+#endif //HOGMAPPEDFILE_H
@@ -0,0 +1,156 @@
+#ifndef HOGNPYWRITER_H
+#define HOGNPYWRITER_H
+
+#include "hogdescriptor.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <span>
+#include <string>
+#include <vector>
+
+/**
+ * @brief Writers of NumPy .npy and .npz files
+ *
+ * Arrays are stored as little-endian float32 ('<f4', C order), quantized vectors as float16 ('<f2')
+ * or as 8-bit codes ('|u1') with their float32 scales. The .npy header is padded
+ * so that the data starts on a 64-byte boundary, and the data of a contiguous array
+ * goes to the file in a single write, straight from the memory it lives in.
+ */
+namespace npy {
+
+/**
+ * @brief Save an array of float32 values as a .npy file
+ *
+ * @param path Path of the .npy file
+ * @param data Values in C order
+ * @param shape Size of each dimension, their product must match the number of values
+ */
+void save(const std::string& path, std::span<const float> data, std::span<const size_t> shape);
+
+/**
+ * @brief Save a HOG feature vector as a 1-D .npy array
+ *
+ * @param path Path of the .npy file
+ * @param vector Feature vector, for example HOGDescriptor::getHOGFeatureView()
+ */
+void save(const std::string& path, std::span<const float> vector);
+
+/**
+ * @brief Save a CV_32F matrix as a 2-D .npy array, for example the output of computeHOGBatch
+ *
+ * @param path Path of the .npy file
+ * @param matrix Single-channel float matrix
+ */
+void save(const std::string& path, const cv::Mat& matrix);
+
+/**
+ * @brief Save a FLOAT16 vector as a 1-D float16 .npy array
+ *
+ * UINT8 vectors need a second array for their scales, NpzWriter stores both.
+ *
+ * @param path Path of the .npy file
+ * @param vector Quantized vector, for example HOGDescriptor::getHOGFeatureVector(HOGValueType::FLOAT16)
+ */
+void save(const std::string& path, const QuantizedVector& vector);
+
+/**
+ * @brief Save cell histograms as a [cells_y, cells_x, bins] .npy tensor
+ *
+ * @param path Path of the .npy file
+ * @param cells Cell histograms, for example HOGDescriptor::getCellHistograms()
+ */
+void save(const std::string& path, const CellHistograms& cells);
+
+/**
+ * @brief Writer of .npz archives, one uncompressed .npy member per array
+ *
+ * Members are stored without compression (ZIP64 records), so numpy.load reads them directly.
+ */
+class NpzWriter {
+public:
+    /**
+     * @brief Create the archive
+     *
+     * @param path Path of the .npz file
+     */
+    explicit NpzWriter(const std::string& path);
+    /**
+     * @brief Close the archive if it is still open
+     */
+    ~NpzWriter();
+
+    NpzWriter(const NpzWriter&) = delete;
+    NpzWriter& operator=(const NpzWriter&) = delete;
+
+    /**
+     * @brief Add an array of float32 values
+     *
+     * @param name Name of the array in numpy.load, without the .npy extension
+     * @param data Values in C order
+     * @param shape Size of each dimension
+     */
+    void add(const std::string& name, std::span<const float> data, std::span<const size_t> shape);
+
+    /**
+     * @brief Add a CV_32F matrix as a 2-D array
+     *
+     * @param name Name of the array
+     * @param matrix Single-channel float matrix
+     */
+    void add(const std::string& name, const cv::Mat& matrix);
+
+    /**
+     * @brief Add a quantized vector
+     *
+     * FLOAT16 vectors become a 1-D float16 array. UINT8 vectors become a [groups, groupLength]
+     * uint8 array of codes and a float32 array of the group scales named name + "_scales",
+     * values = codes * scales[:, None].
+     *
+     * @param name Name of the array
+     * @param vector Quantized vector
+     */
+    void add(const std::string& name, const QuantizedVector& vector);
+
+    /**
+     * @brief Add cell histograms as a [cells_y, cells_x, bins] tensor
+     *
+     * @param name Name of the array
+     * @param cells Cell histograms
+     */
+    void add(const std::string& name, const CellHistograms& cells);
+
+    /**
+     * @brief Write the central directory, no more arrays can be added
+     */
+    void close();
+
+private:
+    /**
+     * @brief Central directory record of one member
+     */
+    struct Entry {
+        std::string name; //!< Member file name
+        uint32_t crc; //!< CRC-32 of the member
+        uint64_t size; //!< Size of the member in bytes
+        uint64_t offset; //!< Offset of the local header
+    };
+
+    /**
+     * @brief Add one member made of a header and row-contiguous data
+     *
+     * @param name Name of the array
+     * @param dtype NumPy type of the values
+     * @param rows Contiguous runs of values in C order
+     * @param shape Size of each dimension
+     */
+    void addRows(const std::string& name, const char* dtype, std::span<const std::span<const std::byte>> rows, std::span<const size_t> shape);
+
+    std::ofstream file_; //!< Archive file
+    uint64_t offset_ = 0; //!< Bytes written so far
+    std::vector<Entry> entries_; //!< Members written so far
+};
+
+} // namespace npy
+
+#endif //HOGNPYWRITER_H
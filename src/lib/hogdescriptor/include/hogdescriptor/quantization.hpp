@@ -0,0 +1,113 @@
+#ifndef HOGQUANTIZATION_H
+#define HOGQUANTIZATION_H
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+/**
+ * @brief Type of the values of a serialized feature vector
+ *
+ * The numbers are the valueType field of the feature store header.
+ */
+enum class HOGValueType : uint32_t {
+    FLOAT32 = 0, //!< 32-bit floats, the values as computed
+    FLOAT16 = 1, //!< IEEE half precision floats, 2 bytes per value
+    UINT8 = 2 //!< 8-bit codes scaled per group of values (one block of the descriptor, or one cell of the compact layout), 1 byte per value and 4 per group
+};
+
+/**
+ * @brief Feature vector in a quantized value type
+ */
+struct QuantizedVector {
+    HOGValueType type = HOGValueType::FLOAT16; //!< FLOAT16 or UINT8
+    size_t groupLength = 0; //!< Number of values sharing one scale, UINT8 only
+    std::vector<uint16_t> halfs; //!< Half precision bit patterns, FLOAT16 only
+    std::vector<uint8_t> codes; //!< Codes of the values, value = code * scale of its group, UINT8 only
+    std::vector<float> scales; //!< Scale of each group of groupLength codes, UINT8 only
+
+    /**
+     * @brief Number of values
+     */
+    size_t size() const { return type == HOGValueType::UINT8 ? codes.size() : halfs.size(); }
+
+    /**
+     * @brief Number of bytes taken by the values and the scales
+     */
+    size_t bytes() const { return halfs.size() * sizeof(uint16_t) + codes.size() + scales.size() * sizeof(float); }
+
+    /**
+     * @brief Values converted back to float
+     */
+    std::vector<float> dequantize() const;
+};
+
+/**
+ * @brief Conversions between float vectors and the quantized value types
+ *
+ * Accuracy, for a value v and its dequantized copy v':
+ * - FLOAT16 rounds to nearest even, |v - v'| <= |v| * 2^-11 for |v| in [2^-14, 65504]
+ *   and |v - v'| <= 2^-25 below. Normalized HOG blocks lie in [0, 1], so every value is off
+ *   by at most 2^-12 (2.4e-4), by at most 2^-13 for the default norm which clips at 0.5.
+ * - UINT8 maps each group to codes 0..255 with scale = max(group) / 255 and rounds to nearest,
+ *   |v - v'| <= max(group) / 510, 9.8e-4 for the default norm. Values must be non-negative,
+ *   negative ones are stored as 0.
+ *
+ * The conversions use F16C and SSE4.1 when the CPU has them, the results are bit-identical
+ * to the portable conversions.
+ */
+namespace quant {
+
+static constexpr float FLOAT16_RELATIVE_ERROR = 1.0f / 2048; //!< Relative error bound of FLOAT16 for normal halves
+static constexpr float FLOAT16_ABSOLUTE_ERROR = 1.0f / (1 << 25); //!< Absolute error bound of FLOAT16 below 2^-14
+static constexpr float UINT8_GROUP_ERROR = 1.0f / 510; //!< Error bound of UINT8 relative to the largest value of the group
+
+/**
+ * @brief Convert floats to half precision, rounding to nearest even
+ *
+ * @param values Input values
+ * @param halfs Output bit patterns, as many as values
+ */
+void toFloat16(std::span<const float> values, std::span<uint16_t> halfs);
+
+/**
+ * @brief Convert half precision values to floats, exactly
+ *
+ * @param halfs Input bit patterns
+ * @param values Output values, as many as halfs
+ */
+void fromFloat16(std::span<const uint16_t> halfs, std::span<float> values);
+
+/**
+ * @brief Quantize non-negative floats to 8-bit codes with one scale per group
+ *
+ * @param values Input values, a whole number of groups
+ * @param groupLength Number of values in each group
+ * @param codes Output codes, as many as values
+ * @param scales Output scale of each group
+ */
+void toUint8(std::span<const float> values, size_t groupLength, std::span<uint8_t> codes, std::span<float> scales);
+
+/**
+ * @brief Convert 8-bit codes back to floats
+ *
+ * @param codes Input codes, a whole number of groups
+ * @param scales Scale of each group
+ * @param groupLength Number of codes in each group
+ * @param values Output values, as many as codes
+ */
+void fromUint8(std::span<const uint8_t> codes, std::span<const float> scales, size_t groupLength, std::span<float> values);
+
+/**
+ * @brief Quantize a feature vector
+ *
+ * @param values Input values
+ * @param type FLOAT16 or UINT8
+ * @param groupLength Number of values sharing one scale, UINT8 only
+ */
+QuantizedVector quantize(std::span<const float> values, HOGValueType type, size_t groupLength);
+
+} // namespace quant
+
+#endif //HOGQUANTIZATION_H
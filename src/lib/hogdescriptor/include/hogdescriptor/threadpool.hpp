@@ -0,0 +1,106 @@
+#ifndef HOGTHREADPOOL_H
+#define HOGTHREADPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief Work-stealing thread pool
+ *
+ * Every worker owns a task deque: it takes its own tasks from the back and,
+ * when it runs out, steals the oldest tasks of the other workers.
+ * Threads waiting for a parallelFor run pending tasks instead of blocking,
+ * so parallel loops may be nested inside pool tasks.
+ */
+class ThreadPool {
+public:
+    /**
+     * @brief Construct a new ThreadPool object
+     *
+     * @param threads Number of worker threads, 0 uses the number of hardware threads
+     */
+    explicit ThreadPool(unsigned threads = 0);
+    /**
+     * @brief Finish the queued tasks and join the workers
+     */
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    /**
+     * @brief Number of worker threads
+     */
+    unsigned size() const { return static_cast<unsigned>(threads_.size()); }
+
+    /**
+     * @brief Queue a task for any worker
+     *
+     * @param task Task to run
+     */
+    void submit(std::function<void()> task);
+
+    /**
+     * @brief Run a loop body over [begin, end) split into chunks, returns when every chunk is done
+     *
+     * The first exception thrown by the body is rethrown to the caller.
+     *
+     * @param begin First index
+     * @param end Index past the last one
+     * @param body Function called with the [begin, end) range of each chunk
+     * @param grain Minimal number of indices per chunk
+     */
+    void parallelFor(int begin, int end, const std::function<void(int, int)>& body, int grain = 1);
+
+    /**
+     * @brief Pool shared by the library, sized to the hardware
+     */
+    static ThreadPool& global();
+
+private:
+    /**
+     * @brief Task deque of one worker
+     * 
+     * A ring buffer that only grows, so a warm pool queues tasks without heap allocations.
+     */
+    struct Queue {
+        std::mutex mutex; //!< Guards the tasks
+        std::vector<std::function<void()>> ring; //!< Queued tasks, the owner works at the back
+        size_t head = 0; //!< Ring index of the oldest task
+        size_t count = 0; //!< Number of queued tasks
+
+        void pushBack(std::function<void()> task);
+        std::function<void()> popBack();
+        std::function<void()> popFront();
+    };
+
+    /**
+     * @brief Take one queued task, own tasks first, then steal
+     *
+     * @param task Output task
+     * @return True if a task was taken
+     */
+    bool takeTask(std::function<void()>& task);
+
+    /**
+     * @brief Main loop of a worker thread
+     *
+     * @param index Index of the worker
+     */
+    void workerLoop(unsigned index);
+
+    std::vector<std::unique_ptr<Queue>> queues_; //!< One deque per worker
+    std::vector<std::thread> threads_; //!< Worker threads
+    std::mutex sleepMutex_; //!< Guards the sleeping workers
+    std::condition_variable wake_; //!< Wakes the workers on new tasks
+    std::atomic<size_t> pending_{0}; //!< Number of queued tasks
+    std::atomic<unsigned> nextQueue_{0}; //!< Round-robin queue for tasks from outside the pool
+    bool stop_ = false; //!< Set when the pool is destroyed
+};
+
+#endif //HOGTHREADPOOL_H
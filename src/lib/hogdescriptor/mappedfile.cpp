@@ -0,0 +1,61 @@
+#include "include/hogdescriptor/mappedfile.hpp"
+#include <stdexcept>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::MappedFile(const std::string& path, const char* kind){
+    const std::string opening = std::string("Error opening the ") + kind + "!";
+    const std::string mapping = std::string("Error mapping the ") + kind + "!";
+#ifdef _WIN32
+    file_ = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file_ == INVALID_HANDLE_VALUE) {
+        file_ = nullptr;
+        throw std::runtime_error(opening);
+    }
+    LARGE_INTEGER size;
+    GetFileSizeEx(file_, &size);
+    length_ = static_cast<size_t>(size.QuadPart);
+    mapping_ = length_ ? CreateFileMappingA(file_, nullptr, PAGE_READONLY, 0, 0, nullptr) : nullptr;
+    data_ = mapping_ ? static_cast<const uint8_t*>(MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0)) : nullptr;
+    if (!data_) {
+        if (mapping_) CloseHandle(mapping_);
+        CloseHandle(file_);
+        throw std::runtime_error(mapping);
+    }
+#else
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error(opening);
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size == 0) {
+        ::close(fd);
+        throw std::runtime_error(opening);
+    }
+    length_ = static_cast<size_t>(info.st_size);
+    void* mapped = mmap(nullptr, length_, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (mapped == MAP_FAILED) {
+        throw std::runtime_error(mapping);
+    }
+    data_ = static_cast<const uint8_t*>(mapped);
+#endif
+}
+
+MappedFile::~MappedFile(){
+#ifdef _WIN32
+    UnmapViewOfFile(data_);
+    CloseHandle(mapping_);
+    CloseHandle(file_);
+#else
+    munmap(const_cast<uint8_t*>(data_), length_);
+#endif
+}
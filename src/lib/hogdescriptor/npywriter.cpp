@@ -0,0 +1,318 @@
+#include "include/hogdescriptor/npywriter.hpp"
+#include <array>
+#include <bit>
+#include <stdexcept>
+
+namespace npy {
+
+namespace {
+
+// The data is written as it lies in memory
+static_assert(std::endian::native == std::endian::little, "The .npy writer stores native little-endian floats");
+
+const size_t DATA_ALIGNMENT = 64;
+
+// NumPy dtypes of the stored values
+const char* const DTYPE_FLOAT32 = "<f4";
+const char* const DTYPE_FLOAT16 = "<f2";
+const char* const DTYPE_UINT8 = "|u1";
+
+using ByteRows = std::vector<std::span<const std::byte>>;
+
+// Little-endian fields of the binary headers
+void put16(std::string& out, uint16_t value){
+    for (int i = 0; i < 2; ++i) out.push_back(static_cast<char>(value >> (8 * i)));
+}
+void put32(std::string& out, uint32_t value){
+    for (int i = 0; i < 4; ++i) out.push_back(static_cast<char>(value >> (8 * i)));
+}
+void put64(std::string& out, uint64_t value){
+    for (int i = 0; i < 8; ++i) out.push_back(static_cast<char>(value >> (8 * i)));
+}
+
+// .npy v1.0 header, padded so that the data starts at a multiple of 64 bytes from base
+std::string npyHeader(const char* dtype, std::span<const size_t> shape, uint64_t base){
+    // Python tuple syntax: (), (n,) or (a, b, ...)
+    std::string dict = std::string("{'descr': '") + dtype + "', 'fortran_order': False, 'shape': (";
+    for (size_t i = 0; i < shape.size(); ++i) {
+        dict += (i > 0 ? ", " : "") + std::to_string(shape[i]);
+    }
+    dict += shape.size() == 1 ? ",), }" : "), }";
+
+    // magic (6) + version (2) + header length (2) + dictionary + padding + '\n'
+    size_t unpadded = 10 + dict.size() + 1;
+    size_t padding = (DATA_ALIGNMENT - (base + unpadded) % DATA_ALIGNMENT) % DATA_ALIGNMENT;
+    dict.append(padding, ' ');
+    dict.push_back('\n');
+    if (dict.size() > UINT16_MAX) {
+        throw std::invalid_argument("npy: too many dimensions");
+    }
+
+    std::string header("\x93NUMPY\x01\x00", 8);
+    put16(header, static_cast<uint16_t>(dict.size()));
+    return header + dict;
+}
+
+size_t checkShape(size_t values, std::span<const size_t> shape){
+    size_t count = 1;
+    for (size_t dim : shape) {
+        count *= dim;
+    }
+    if (count != values) {
+        throw std::invalid_argument("npy: shape does not match the number of values");
+    }
+    return count;
+}
+
+// Rows of a matrix, a single run if it is continuous
+ByteRows matrixRows(const cv::Mat& matrix){
+    if (matrix.type() != CV_32FC1 || matrix.dims != 2) {
+        throw std::invalid_argument("npy: matrix must be a 2-D CV_32F matrix");
+    }
+    if (matrix.isContinuous()) {
+        return {std::as_bytes(std::span<const float>(matrix.ptr<float>(0), matrix.total()))};
+    }
+    ByteRows rows;
+    for (int y = 0; y < matrix.rows; ++y) {
+        rows.push_back(std::as_bytes(std::span<const float>(matrix.ptr<float>(y), static_cast<size_t>(matrix.cols))));
+    }
+    return rows;
+}
+
+// dtype and data of a quantized vector, the codes without their scales
+std::pair<const char*, std::span<const std::byte>> quantizedData(const QuantizedVector& vector){
+    if (vector.type == HOGValueType::FLOAT16) {
+        return {DTYPE_FLOAT16, std::as_bytes(std::span<const uint16_t>(vector.halfs))};
+    }
+    return {DTYPE_UINT8, std::as_bytes(std::span<const uint8_t>(vector.codes))};
+}
+
+uint32_t crc32(uint32_t crc, const void* data, size_t size){
+    static const std::array<uint32_t, 256> table = [] {
+        std::array<uint32_t, 256> values{};
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; ++k) {
+                c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            }
+            values[i] = c;
+        }
+        return values;
+    }();
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    crc = ~crc;
+    for (size_t i = 0; i < size; ++i) {
+        crc = table[(crc ^ bytes[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+void writeNpy(const std::string& path, const char* dtype, std::span<const std::span<const std::byte>> rows, std::span<const size_t> shape){
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    if (!file) {
+        throw std::runtime_error("Error creating the .npy file!");
+    }
+    std::string header = npyHeader(dtype, shape, 0);
+    file.write(header.data(), static_cast<std::streamsize>(header.size()));
+    for (std::span<const std::byte> row : rows) {
+        file.write(reinterpret_cast<const char*>(row.data()), static_cast<std::streamsize>(row.size_bytes()));
+    }
+    if (!file) {
+        throw std::runtime_error("Error writing the .npy file!");
+    }
+}
+
+} // namespace
+
+void save(const std::string& path, std::span<const float> data, std::span<const size_t> shape){
+    checkShape(data.size(), shape);
+    std::span<const std::byte> rows[] = {std::as_bytes(data)};
+    writeNpy(path, DTYPE_FLOAT32, rows, shape);
+}
+
+void save(const std::string& path, std::span<const float> vector){
+    const size_t shape[] = {vector.size()};
+    save(path, vector, shape);
+}
+
+void save(const std::string& path, const cv::Mat& matrix){
+    const size_t shape[] = {static_cast<size_t>(matrix.rows), static_cast<size_t>(matrix.cols)};
+    writeNpy(path, DTYPE_FLOAT32, matrixRows(matrix), shape);
+}
+
+void save(const std::string& path, const QuantizedVector& vector){
+    if (vector.type != HOGValueType::FLOAT16) {
+        throw std::invalid_argument("npy: UINT8 vectors need their scales, add them to an .npz archive");
+    }
+    const size_t shape[] = {vector.size()};
+    std::span<const std::byte> rows[] = {quantizedData(vector).second};
+    writeNpy(path, DTYPE_FLOAT16, rows, shape);
+}
+
+void save(const std::string& path, const CellHistograms& cells){
+    const size_t shape[] = {static_cast<size_t>(cells.rows()), static_cast<size_t>(cells.cols()), static_cast<size_t>(cells.bins())};
+    save(path, std::span<const float>(cells.data(), cells.size()), shape);
+}
+
+NpzWriter::NpzWriter(const std::string& path) : file_(path, std::ios::binary | std::ios::trunc){
+    if (!file_) {
+        throw std::runtime_error("Error creating the .npz file!");
+    }
+}
+
+NpzWriter::~NpzWriter(){
+    try {
+        close();
+    } catch (const std::exception& e) {
+        std::cerr << "Error closing the .npz file: " << e.what() << std::endl;
+    }
+}
+
+void NpzWriter::add(const std::string& name, std::span<const float> data, std::span<const size_t> shape){
+    checkShape(data.size(), shape);
+    std::span<const std::byte> rows[] = {std::as_bytes(data)};
+    addRows(name, DTYPE_FLOAT32, rows, shape);
+}
+
+void NpzWriter::add(const std::string& name, const cv::Mat& matrix){
+    const size_t shape[] = {static_cast<size_t>(matrix.rows), static_cast<size_t>(matrix.cols)};
+    addRows(name, DTYPE_FLOAT32, matrixRows(matrix), shape);
+}
+
+void NpzWriter::add(const std::string& name, const QuantizedVector& vector){
+    auto [dtype, data] = quantizedData(vector);
+    std::span<const std::byte> rows[] = {data};
+    if (vector.type == HOGValueType::FLOAT16) {
+        const size_t shape[] = {vector.size()};
+        addRows(name, dtype, rows, shape);
+        return;
+    }
+    if (vector.groupLength == 0 || vector.scales.size() * vector.groupLength != vector.size()) {
+        throw std::invalid_argument("npy: one scale per group is required");
+    }
+    const size_t shape[] = {vector.scales.size(), vector.groupLength};
+    addRows(name, dtype, rows, shape);
+    add(name + "_scales", vector.scales, std::span<const size_t>(shape, 1));
+}
+
+void NpzWriter::add(const std::string& name, const CellHistograms& cells){
+    const size_t shape[] = {static_cast<size_t>(cells.rows()), static_cast<size_t>(cells.cols()), static_cast<size_t>(cells.bins())};
+    add(name, std::span<const float>(cells.data(), cells.size()), shape);
+}
+
+void NpzWriter::addRows(const std::string& name, const char* dtype, std::span<const std::span<const std::byte>> rows, std::span<const size_t> shape){
+    if (!file_.is_open()) {
+        throw std::runtime_error("The .npz file is closed!");
+    }
+
+    // Local header: ZIP64 sizes in the extra field, no compression
+    const std::string fileName = name + ".npy";
+    const size_t localHeaderSize = 30 + fileName.size() + 20;
+    std::string npyPart = npyHeader(dtype, shape, offset_ + localHeaderSize);
+    uint64_t size = npyPart.size();
+    uint32_t crc = crc32(0, npyPart.data(), npyPart.size());
+    for (std::span<const std::byte> row : rows) {
+        size += row.size_bytes();
+        crc = crc32(crc, row.data(), row.size_bytes());
+    }
+
+    std::string header;
+    put32(header, 0x04034b50);
+    put16(header, 45); // version needed: ZIP64
+    put16(header, 0); // flags
+    put16(header, 0); // stored
+    put16(header, 0); // time
+    put16(header, 0x21); // date 1980-01-01
+    put32(header, crc);
+    put32(header, 0xFFFFFFFF);
+    put32(header, 0xFFFFFFFF);
+    put16(header, static_cast<uint16_t>(fileName.size()));
+    put16(header, 20);
+    header += fileName;
+    put16(header, 0x0001);
+    put16(header, 16);
+    put64(header, size);
+    put64(header, size);
+    header += npyPart;
+
+    file_.write(header.data(), static_cast<std::streamsize>(header.size()));
+    for (std::span<const std::byte> row : rows) {
+        file_.write(reinterpret_cast<const char*>(row.data()), static_cast<std::streamsize>(row.size_bytes()));
+    }
+    if (!file_) {
+        throw std::runtime_error("Error writing the .npz file!");
+    }
+
+    entries_.push_back({fileName, crc, size, offset_});
+    offset_ += localHeaderSize + size;
+}
+
+void NpzWriter::close(){
+    if (!file_.is_open()) {
+        return;
+    }
+
+    std::string directory;
+    for (const Entry& entry : entries_) {
+        put32(directory, 0x02014b50);
+        put16(directory, 45); // version made by
+        put16(directory, 45); // version needed
+        put16(directory, 0);
+        put16(directory, 0);
+        put16(directory, 0);
+        put16(directory, 0x21);
+        put32(directory, entry.crc);
+        put32(directory, 0xFFFFFFFF);
+        put32(directory, 0xFFFFFFFF);
+        put16(directory, static_cast<uint16_t>(entry.name.size()));
+        put16(directory, 28);
+        put16(directory, 0); // comment
+        put16(directory, 0); // disk
+        put16(directory, 0); // internal attributes
+        put32(directory, 0); // external attributes
+        put32(directory, 0xFFFFFFFF);
+        directory += entry.name;
+        put16(directory, 0x0001);
+        put16(directory, 24);
+        put64(directory, entry.size);
+        put64(directory, entry.size);
+        put64(directory, entry.offset);
+    }
+
+    // ZIP64 end of central directory, its locator and the classic end record
+    uint64_t directoryOffset = offset_;
+    uint64_t end64Offset = directoryOffset + directory.size();
+    put32(directory, 0x06064b50);
+    put64(directory, 44);
+    put16(directory, 45);
+    put16(directory, 45);
+    put32(directory, 0);
+    put32(directory, 0);
+    put64(directory, entries_.size());
+    put64(directory, entries_.size());
+    put64(directory, end64Offset - directoryOffset);
+    put64(directory, directoryOffset);
+
+    put32(directory, 0x07064b50);
+    put32(directory, 0);
+    put64(directory, end64Offset);
+    put32(directory, 1);
+
+    put32(directory, 0x06054b50);
+    put16(directory, 0);
+    put16(directory, 0);
+    put16(directory, 0xFFFF);
+    put16(directory, 0xFFFF);
+    put32(directory, 0xFFFFFFFF);
+    put32(directory, 0xFFFFFFFF);
+    put16(directory, 0);
+
+    file_.write(directory.data(), static_cast<std::streamsize>(directory.size()));
+    bool good = file_.good();
+    file_.close();
+    if (!good) {
+        throw std::runtime_error("Error writing the .npz file!");
+    }
+}
+
+} // namespace npy
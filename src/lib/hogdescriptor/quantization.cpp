@@ -0,0 +1,322 @@
+#include "include/hogdescriptor/quantization.hpp"
+#include <opencv2/core.hpp>
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <stdexcept>
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define HOG_X86_DISPATCH 1
+#include <immintrin.h>
+#else
+#define HOG_X86_DISPATCH 0
+#endif
+
+namespace quant {
+
+namespace {
+
+// Round to nearest even, NaN payloads kept and quieted like F16C
+inline uint16_t floatToHalf(float value) {
+    uint32_t bits = std::bit_cast<uint32_t>(value);
+    uint16_t sign = static_cast<uint16_t>((bits >> 16) & 0x8000);
+    uint32_t magnitude = bits & 0x7FFFFFFF;
+    if (magnitude >= 0x47800000) {
+        // 2^16 and above: infinity, NaN
+        return sign | (magnitude > 0x7F800000 ? 0x7E00 | ((magnitude >> 13) & 0x3FF) : 0x7C00);
+    }
+    if (magnitude < 0x38800000) {
+        // Below 2^-14: the addition rounds the value to a multiple of 2^-24, the subnormal step
+        float rounded = std::bit_cast<float>(magnitude) + 0.5f;
+        return sign | static_cast<uint16_t>(std::bit_cast<uint32_t>(rounded) - 0x3F000000);
+    }
+    // Rebias the exponent and round, a carry out of the mantissa gives the next power of two or infinity
+    uint32_t odd = (magnitude >> 13) & 1;
+    magnitude += 0xC8000FFF + odd;
+    return sign | static_cast<uint16_t>(magnitude >> 13);
+}
+
+inline float halfToFloat(uint16_t half) {
+    uint32_t sign = static_cast<uint32_t>(half & 0x8000) << 16;
+    uint32_t exponent = (half >> 10) & 0x1F;
+    uint32_t mantissa = half & 0x3FF;
+    if (exponent == 0x1F) {
+        return std::bit_cast<float>(sign | 0x7F800000 | (mantissa << 13) | (mantissa ? 0x400000 : 0));
+    }
+    if (exponent == 0) {
+        float subnormal = static_cast<float>(mantissa) * (1.0f / (1 << 24));
+        return std::bit_cast<float>(sign | std::bit_cast<uint32_t>(subnormal));
+    }
+    return std::bit_cast<float>(sign | ((exponent + 112) << 23) | (mantissa << 13));
+}
+
+void toFloat16Scalar(const float* values, size_t n, uint16_t* halfs) {
+    for (size_t i = 0; i < n; ++i) {
+        halfs[i] = floatToHalf(values[i]);
+    }
+}
+
+void fromFloat16Scalar(const uint16_t* halfs, size_t n, float* values) {
+    for (size_t i = 0; i < n; ++i) {
+        values[i] = halfToFloat(halfs[i]);
+    }
+}
+
+#if HOG_X86_DISPATCH
+
+__attribute__((target("avx,f16c")))
+void toFloat16F16C(const float* values, size_t n, uint16_t* halfs) {
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128i packed = _mm256_cvtps_ph(_mm256_loadu_ps(values + i), _MM_FROUND_TO_NEAREST_INT);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(halfs + i), packed);
+    }
+    toFloat16Scalar(values + i, n - i, halfs + i);
+}
+
+__attribute__((target("avx,f16c")))
+void fromFloat16F16C(const uint16_t* halfs, size_t n, float* values) {
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128i packed = _mm_loadu_si128(reinterpret_cast<const __m128i*>(halfs + i));
+        _mm256_storeu_ps(values + i, _mm256_cvtph_ps(packed));
+    }
+    fromFloat16Scalar(halfs + i, n - i, values + i);
+}
+
+#endif
+
+using ToFloat16Fn = void (*)(const float*, size_t, uint16_t*);
+using FromFloat16Fn = void (*)(const uint16_t*, size_t, float*);
+
+bool hasF16C() {
+#if HOG_X86_DISPATCH
+    static const bool supported = cv::checkHardwareSupport(CV_CPU_AVX) && cv::checkHardwareSupport(CV_CPU_FP16);
+    return supported;
+#else
+    return false;
+#endif
+}
+
+ToFloat16Fn toFloat16Kernel() {
+#if HOG_X86_DISPATCH
+    if (hasF16C()) {
+        return toFloat16F16C;
+    }
+#endif
+    return toFloat16Scalar;
+}
+
+FromFloat16Fn fromFloat16Kernel() {
+#if HOG_X86_DISPATCH
+    if (hasF16C()) {
+        return fromFloat16F16C;
+    }
+#endif
+    return fromFloat16Scalar;
+}
+
+// Maximum of non-negative floats, compared as integers: that order is the same for them,
+// negative values fall below the zero start, and unlike a float maximum it vectorizes without -ffast-math
+inline float groupMax(const float* values, size_t length) {
+    int32_t maximum = 0;
+    for (size_t i = 0; i < length; ++i) {
+        maximum = std::max(maximum, std::bit_cast<int32_t>(values[i]));
+    }
+    return std::bit_cast<float>(maximum);
+}
+
+// Code of one value, the SIMD kernels do the same operations
+inline uint8_t toCode(float value, float inverse) {
+    return static_cast<uint8_t>(std::min(std::max(value, 0.0f) * inverse + 0.5f, 255.0f));
+}
+
+inline float toScale(float maximum) {
+    return maximum / 255.0f;
+}
+
+inline float toInverse(float maximum) {
+    return maximum > 0.0f ? 255.0f / maximum : 0.0f;
+}
+
+void toUint8Scalar(const float* values, size_t groups, size_t groupLength, uint8_t* codes, float* scales) {
+    for (size_t group = 0; group < groups; ++group) {
+        const float* in = values + group * groupLength;
+        uint8_t* out = codes + group * groupLength;
+        float maximum = groupMax(in, groupLength);
+        float inverse = toInverse(maximum);
+        for (size_t i = 0; i < groupLength; ++i) {
+            out[i] = toCode(in[i], inverse);
+        }
+        scales[group] = toScale(maximum);
+    }
+}
+
+void fromUint8Scalar(const uint8_t* codes, const float* scales, size_t groups, size_t groupLength, float* values) {
+    for (size_t group = 0; group < groups; ++group) {
+        const uint8_t* in = codes + group * groupLength;
+        float* out = values + group * groupLength;
+        float scale = scales[group];
+        for (size_t i = 0; i < groupLength; ++i) {
+            out[i] = static_cast<float>(in[i]) * scale;
+        }
+    }
+}
+
+#if HOG_X86_DISPATCH
+
+__attribute__((target("sse4.1")))
+void toUint8SSE41(const float* values, size_t groups, size_t groupLength, uint8_t* codes, float* scales) {
+    const __m128 zero = _mm_setzero_ps(), half = _mm_set1_ps(0.5f), top = _mm_set1_ps(255.0f);
+    for (size_t group = 0; group < groups; ++group) {
+        const float* in = values + group * groupLength;
+        uint8_t* out = codes + group * groupLength;
+
+        // Same integer maximum of the bit patterns as groupMax
+        __m128i lanes = _mm_setzero_si128();
+        size_t i = 0;
+        for (; i + 4 <= groupLength; i += 4) {
+            lanes = _mm_max_epi32(lanes, _mm_castps_si128(_mm_loadu_ps(in + i)));
+        }
+        lanes = _mm_max_epi32(lanes, _mm_shuffle_epi32(lanes, _MM_SHUFFLE(1, 0, 3, 2)));
+        lanes = _mm_max_epi32(lanes, _mm_shuffle_epi32(lanes, _MM_SHUFFLE(2, 3, 0, 1)));
+        int32_t maximumBits = std::max(_mm_cvtsi128_si32(lanes), std::bit_cast<int32_t>(groupMax(in + i, groupLength - i)));
+        float maximum = std::bit_cast<float>(maximumBits);
+        float inverse = toInverse(maximum);
+
+        const __m128 scale = _mm_set1_ps(inverse);
+        i = 0;
+        for (; i + 16 <= groupLength; i += 16) {
+            __m128i packed[4];
+            for (int k = 0; k < 4; ++k) {
+                __m128 value = _mm_max_ps(_mm_loadu_ps(in + i + 4 * k), zero);
+                value = _mm_min_ps(_mm_add_ps(_mm_mul_ps(value, scale), half), top);
+                packed[k] = _mm_cvttps_epi32(value);
+            }
+            __m128i words = _mm_packus_epi32(packed[0], packed[1]);
+            __m128i words2 = _mm_packus_epi32(packed[2], packed[3]);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_packus_epi16(words, words2));
+        }
+        for (; i < groupLength; ++i) {
+            out[i] = toCode(in[i], inverse);
+        }
+        scales[group] = toScale(maximum);
+    }
+}
+
+__attribute__((target("sse4.1")))
+void fromUint8SSE41(const uint8_t* codes, const float* scales, size_t groups, size_t groupLength, float* values) {
+    for (size_t group = 0; group < groups; ++group) {
+        const uint8_t* in = codes + group * groupLength;
+        float* out = values + group * groupLength;
+        const __m128 scale = _mm_set1_ps(scales[group]);
+        size_t i = 0;
+        for (; i + 4 <= groupLength; i += 4) {
+            int32_t quad;
+            std::memcpy(&quad, in + i, sizeof(quad));
+            __m128i widened = _mm_cvtepu8_epi32(_mm_cvtsi32_si128(quad));
+            _mm_storeu_ps(out + i, _mm_mul_ps(_mm_cvtepi32_ps(widened), scale));
+        }
+        for (; i < groupLength; ++i) {
+            out[i] = static_cast<float>(in[i]) * scales[group];
+        }
+    }
+}
+
+#endif
+
+using ToUint8Fn = void (*)(const float*, size_t, size_t, uint8_t*, float*);
+using FromUint8Fn = void (*)(const uint8_t*, const float*, size_t, size_t, float*);
+
+ToUint8Fn toUint8Kernel() {
+#if HOG_X86_DISPATCH
+    if (cv::checkHardwareSupport(CV_CPU_SSE4_1)) {
+        return toUint8SSE41;
+    }
+#endif
+    return toUint8Scalar;
+}
+
+FromUint8Fn fromUint8Kernel() {
+#if HOG_X86_DISPATCH
+    if (cv::checkHardwareSupport(CV_CPU_SSE4_1)) {
+        return fromUint8SSE41;
+    }
+#endif
+    return fromUint8Scalar;
+}
+
+void checkGroups(size_t length, size_t groupLength, size_t scales) {
+    if (groupLength == 0 || length % groupLength != 0) {
+        throw std::invalid_argument("quant: the values must form whole groups");
+    }
+    if (scales != length / groupLength) {
+        throw std::invalid_argument("quant: one scale per group is required");
+    }
+}
+
+} // namespace
+
+void toFloat16(std::span<const float> values, std::span<uint16_t> halfs) {
+    if (halfs.size() != values.size()) {
+        throw std::invalid_argument("quant: output length differs from the input");
+    }
+    static const ToFloat16Fn kernel = toFloat16Kernel();
+    kernel(values.data(), values.size(), halfs.data());
+}
+
+void fromFloat16(std::span<const uint16_t> halfs, std::span<float> values) {
+    if (values.size() != halfs.size()) {
+        throw std::invalid_argument("quant: output length differs from the input");
+    }
+    static const FromFloat16Fn kernel = fromFloat16Kernel();
+    kernel(halfs.data(), halfs.size(), values.data());
+}
+
+void toUint8(std::span<const float> values, size_t groupLength, std::span<uint8_t> codes, std::span<float> scales) {
+    if (codes.size() != values.size()) {
+        throw std::invalid_argument("quant: output length differs from the input");
+    }
+    checkGroups(values.size(), groupLength, scales.size());
+    static const ToUint8Fn kernel = toUint8Kernel();
+    kernel(values.data(), scales.size(), groupLength, codes.data(), scales.data());
+}
+
+void fromUint8(std::span<const uint8_t> codes, std::span<const float> scales, size_t groupLength, std::span<float> values) {
+    if (values.size() != codes.size()) {
+        throw std::invalid_argument("quant: output length differs from the input");
+    }
+    checkGroups(codes.size(), groupLength, scales.size());
+    static const FromUint8Fn kernel = fromUint8Kernel();
+    kernel(codes.data(), scales.data(), scales.size(), groupLength, values.data());
+}
+
+QuantizedVector quantize(std::span<const float> values, HOGValueType type, size_t groupLength) {
+    QuantizedVector quantized;
+    quantized.type = type;
+    if (type == HOGValueType::FLOAT16) {
+        quantized.halfs.resize(values.size());
+        toFloat16(values, quantized.halfs);
+    } else if (type == HOGValueType::UINT8) {
+        checkGroups(values.size(), groupLength, groupLength ? values.size() / groupLength : 0);
+        quantized.groupLength = groupLength;
+        quantized.codes.resize(values.size());
+        quantized.scales.resize(values.size() / groupLength);
+        toUint8(values, groupLength, quantized.codes, quantized.scales);
+    } else {
+        throw std::invalid_argument("quant: FLOAT32 is not a quantized type");
+    }
+    return quantized;
+}
+
+} // namespace quant
+
+std::vector<float> QuantizedVector::dequantize() const {
+    std::vector<float> values(size());
+    if (type == HOGValueType::FLOAT16) {
+        quant::fromFloat16(halfs, values);
+    } else {
+        quant::fromUint8(codes, scales, groupLength, values);
+    }
+    return values;
+}
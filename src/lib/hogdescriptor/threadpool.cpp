@@ -0,0 +1,199 @@
+#include "include/hogdescriptor/threadpool.hpp"
+#include <algorithm>
+#include <exception>
+
+namespace {
+
+// Pool and queue index of the current worker thread
+thread_local const ThreadPool* currentPool = nullptr;
+thread_local unsigned currentQueue = 0;
+
+} // namespace
+
+void ThreadPool::Queue::pushBack(std::function<void()> task){
+    if (count == ring.size()) {
+        // Unroll the ring into a buffer twice as large
+        std::vector<std::function<void()>> larger(std::max<size_t>(16, ring.size() * 2));
+        for (size_t i = 0; i < count; ++i) {
+            larger[i] = std::move(ring[(head + i) % ring.size()]);
+        }
+        ring = std::move(larger);
+        head = 0;
+    }
+    ring[(head + count) % ring.size()] = std::move(task);
+    count++;
+}
+
+std::function<void()> ThreadPool::Queue::popBack(){
+    count--;
+    return std::move(ring[(head + count) % ring.size()]);
+}
+
+std::function<void()> ThreadPool::Queue::popFront(){
+    std::function<void()> task = std::move(ring[head]);
+    head = (head + 1) % ring.size();
+    count--;
+    return task;
+}
+
+ThreadPool::ThreadPool(unsigned threads){
+    if (threads == 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    for (unsigned i = 0; i < threads; ++i) {
+        queues_.push_back(std::make_unique<Queue>());
+    }
+    for (unsigned i = 0; i < threads; ++i) {
+        threads_.emplace_back(&ThreadPool::workerLoop, this, i);
+    }
+}
+
+ThreadPool::~ThreadPool(){
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex_);
+        stop_ = true;
+    }
+    wake_.notify_all();
+    for (std::thread& thread : threads_) {
+        thread.join();
+    }
+}
+
+void ThreadPool::submit(std::function<void()> task){
+    // Workers keep their own subtasks local, outside tasks are spread round-robin
+    unsigned index = currentPool == this ? currentQueue : nextQueue_++ % size();
+    {
+        std::lock_guard<std::mutex> lock(queues_[index]->mutex);
+        queues_[index]->pushBack(std::move(task));
+    }
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex_);
+        pending_++;
+    }
+    wake_.notify_one();
+}
+
+bool ThreadPool::takeTask(std::function<void()>& task){
+    if (pending_.load() == 0) {
+        return false;
+    }
+
+    unsigned own = currentPool == this ? currentQueue : nextQueue_.load() % size();
+    for (unsigned i = 0; i < size(); ++i) {
+        unsigned index = (own + i) % size();
+        Queue& queue = *queues_[index];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.count == 0) {
+            continue;
+        }
+        // Newest own task keeps the caches warm, the oldest foreign task is the largest to steal
+        if (i == 0 && currentPool == this) {
+            task = queue.popBack();
+        } else {
+            task = queue.popFront();
+        }
+        pending_--;
+        return true;
+    }
+    return false;
+}
+
+void ThreadPool::workerLoop(unsigned index){
+    currentPool = this;
+    currentQueue = index;
+
+    std::function<void()> task;
+    while (true) {
+        if (takeTask(task)) {
+            task();
+            task = nullptr;
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(sleepMutex_);
+        wake_.wait(lock, [this] { return stop_ || pending_.load() > 0; });
+        if (stop_ && pending_.load() == 0) {
+            return;
+        }
+    }
+}
+
+void ThreadPool::parallelFor(int begin, int end, const std::function<void(int, int)>& body, int grain){
+    if (end <= begin) {
+        return;
+    }
+
+    // A few chunks per worker leave room for stealing when the chunk costs differ
+    int chunks = std::min((end - begin + grain - 1) / std::max(grain, 1), static_cast<int>(size()) * 4 + 1);
+    if (chunks <= 1) {
+        body(begin, end);
+        return;
+    }
+
+    // The caller waits for every chunk, so the group lives on its stack.
+    // Tasks capture one pointer and the chunk range, small enough for std::function
+    // to store them without a heap allocation.
+    struct Group {
+        const std::function<void(int, int)>* body;
+        std::mutex mutex;
+        std::condition_variable done;
+        int remaining;
+        std::exception_ptr error;
+
+        void run(int chunkBegin, int chunkEnd) {
+            std::exception_ptr chunkError;
+            try {
+                (*body)(chunkBegin, chunkEnd);
+            } catch (...) {
+                chunkError = std::current_exception();
+            }
+            std::lock_guard<std::mutex> lock(mutex);
+            if (chunkError && !error) {
+                error = chunkError;
+            }
+            if (--remaining == 0) {
+                done.notify_all();
+            }
+        }
+    };
+    Group group;
+    group.body = &body;
+    group.remaining = chunks;
+
+    // The caller takes the first chunk itself
+    int length = end - begin;
+    for (int chunk = 1; chunk < chunks; ++chunk) {
+        int chunkBegin = begin + static_cast<int>(static_cast<long long>(length) * chunk / chunks);
+        int chunkEnd = begin + static_cast<int>(static_cast<long long>(length) * (chunk + 1) / chunks);
+        Group* shared = &group;
+        submit([shared, chunkBegin, chunkEnd] { shared->run(chunkBegin, chunkEnd); });
+    }
+    group.run(begin, begin + static_cast<int>(static_cast<long long>(length) / chunks));
+
+    // Help with the queued work until the last chunk is done
+    std::function<void()> task;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(group.mutex);
+            if (group.remaining == 0) {
+                break;
+            }
+        }
+        if (takeTask(task)) {
+            task();
+            task = nullptr;
+            continue;
+        }
+        // Nothing left to help with, the remaining chunks are running on other threads
+        std::unique_lock<std::mutex> lock(group.mutex);
+        group.done.wait(lock, [&group] { return group.remaining == 0; });
+    }
+
+    if (group.error) {
+        std::rethrow_exception(group.error);
+    }
+}
+
+ThreadPool& ThreadPool::global(){
+    static ThreadPool pool;
+    return pool;
+}
@@ -5,6 +5,7 @@
 #include <vector>
 #include <fstream>
 #include <string>
+#include <span>
 #include <opencv2/opencv.hpp>
 
 /**
@@ -26,17 +27,17 @@ public:
      * @param executablePath Path to the .tex file
      * @param plotName Output file name
      */
-    void cellHistogramPlot(std::vector<float> cellHistogram, int binWidth, const std::string& executablePath, const std::string& plotName);
+    void cellHistogramPlot(std::span<const float> cellHistogram, int binWidth, const std::string& executablePath, const std::string& plotName);
 
     /**
      * @brief Method for creating a .tex file with the histograms of cell within given block
      * 
-     * @param blockHistogram Matrix of cell histogram values
+     * @param blockHistogram Histogram values of each cell in the block
      * @param binWidth Width of the histogram block
      * @param executablePath Path to the .tex file
      * @param plotName Output file name
      */
-    void blockHistogramPlot(std::vector<std::vector<float>> blockHistogram, int binWidth, const std::string& executablePath, const std::string& plotName);
+    void blockHistogramPlot(const std::vector<std::span<const float>>& blockHistogram, int binWidth, const std::string& executablePath, const std::string& plotName);
 };
 
 #endif 
\ No newline at end of file
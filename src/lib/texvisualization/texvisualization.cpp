@@ -3,12 +3,13 @@
 #include <string>
 #include <iostream>
 #include <vector>
+#include <span>
 #include <fstream>
 #include <filesystem>
 
 namespace fs = std::filesystem;
 
-void texHOG::cellHistogramPlot(std::vector<float> values, int binWidth, const std::string& executablePath, const std::string& plotName){
+void texHOG::cellHistogramPlot(std::span<const float> values, int binWidth, const std::string& executablePath, const std::string& plotName){
     
     fs::path directoryPath = fs::path(executablePath);
 
@@ -88,7 +89,7 @@ void texHOG::cellHistogramPlot(std::vector<float> values, int binWidth, const st
     std::cout << "Cell-plot успешно создан!" << std::endl;
 }
 
-void texHOG::blockHistogramPlot(std::vector<std::vector<float>> blockHistogram, int binWidth, const std::string& executablePath, const std::string& plotName) {
+void texHOG::blockHistogramPlot(const std::vector<std::span<const float>>& blockHistogram, int binWidth, const std::string& executablePath, const std::string& plotName) {
 
     fs::path directoryPath = fs::path(executablePath);
 